@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "global.hpp"
+#include "geometry.hpp"
+#include "rect.hpp"
+#include "material.hpp"
+#include "image.hpp"
+#include "bench.hpp"
+
+// Time intersection and shading kernels in isolation on precomputed batches,
+// once with coherent rays fanning out from one origin like primary rays and
+// once with random origins and directions like secondary rays
+//
+// Usage: microbench [texture file] [--output result.json]
+
+#define BENCH_BATCH (1 << 16)
+#define BENCH_REPEATS 5
+
+enum Coherence { COHERENT, RANDOM, COHERENCE_NUM };
+const char * COHERENCE_NAMES[COHERENCE_NUM] = { "coherent", "random" };
+
+struct KernelResult
+{
+    std::string name;
+    double ns[COHERENCE_NUM];
+};
+
+// Keeps the compiler from dropping the timed work
+static volatile float g_sink;
+
+/**
+ * Best of a few runs of op(i) over a batch, in ns per call
+ */
+template <typename Op>
+double time_ns(int count, Op op)
+{
+    double best = FLOAT_INFINITY;
+    float checksum = 0.0f;
+    for (int r = 0; r < BENCH_REPEATS; r++)
+    {
+        double start = wall_seconds();
+        for (int i = 0; i < count; i++) checksum += op(i);
+        best = MIN(best, wall_seconds() - start);
+    }
+    g_sink = checksum;
+    return best / count * 1e9;
+}
+
+/**
+ * Rays towards the [-1.2, 1.2] cube around the origin, where the test objects are
+ */
+std::vector<Geometry::Ray> make_rays(Coherence coherence, int count)
+{
+    std::vector<Geometry::Ray> rays;
+    rays.reserve(count);
+    if (coherence == COHERENT)
+    {
+        // Scanlines of a screen at z = 0 seen from z = -5
+        int side = static_cast<int>(sqrtf((float)count));
+        vec3 origin(0.0f, 0.0f, -5.0f);
+        for (int j = 0; j < side; j++)
+        for (int i = 0; i < side; i++)
+        {
+            vec3 target((i + 0.5f) / side * 2.4f - 1.2f, (j + 0.5f) / side * 2.4f - 1.2f, 0.0f);
+            rays.push_back(Geometry::Ray(origin, target - origin, 0.0f));
+        }
+    }
+    while ((int)rays.size() < count)
+    {
+        vec3 origin = random_unit_vector() * 5.0f;
+        vec3 target = random_vec3(-1.2f, 1.2f);
+        rays.push_back(Geometry::Ray(origin, target - origin, random_float()));
+    }
+    return rays;
+}
+
+void bench_hittable(std::vector<KernelResult> & results, const char * name, const Geometry::Hittable & object)
+{
+    KernelResult result;
+    result.name = name;
+    for (int c = 0; c < COHERENCE_NUM; c++)
+    {
+        std::vector<Geometry::Ray> rays = make_rays((Coherence)c, BENCH_BATCH);
+        result.ns[c] = time_ns(BENCH_BATCH, [&](int i) {
+            Geometry::HitRecord rec;
+            return object.hit(rays[i], 0.001f, FLOAT_INFINITY, rec) ? rec.t : 0.0f;
+        });
+    }
+    results.push_back(result);
+}
+
+void bench_aabb(std::vector<KernelResult> & results)
+{
+    Geometry::AABB box(vec3(-1.0f), vec3(1.0f));
+    KernelResult result;
+    result.name = "AABB::hit";
+    for (int c = 0; c < COHERENCE_NUM; c++)
+    {
+        std::vector<Geometry::Ray> rays = make_rays((Coherence)c, BENCH_BATCH);
+        result.ns[c] = time_ns(BENCH_BATCH, [&](int i) {
+            return box.hit(rays[i], 0.001f, FLOAT_INFINITY) ? 1.0f : 0.0f;
+        });
+    }
+    results.push_back(result);
+}
+
+void bench_materials(std::vector<KernelResult> & results)
+{
+    struct Entry { const char * name; shared_ptr<Material::Material> material; };
+    Entry materials[] = {
+        { "Lambertian::scatter", make_shared<Material::Lambertian>(vec4(0.5f, 0.5f, 0.5f, 1.0f)) },
+        { "Metal::scatter", make_shared<Material::Metal>(vec4(0.7f, 0.6f, 0.5f, 1.0f), 0.2f) },
+        { "Dielectric::scatter", make_shared<Material::Dielectric>(1.5f) },
+        { "DiffuseLight::scatter", make_shared<Material::DiffuseLight>(vec4(4.0f, 4.0f, 4.0f, 1.0f)) },
+    };
+
+    // Hit records of the batches on a unit sphere, cycled through while timing
+    Geometry::Sphere sphere(vec3(0.0f), 1.0f, materials[0].material);
+    std::vector<Geometry::Ray> hit_rays[COHERENCE_NUM];
+    std::vector<Geometry::HitRecord> records[COHERENCE_NUM];
+    for (int c = 0; c < COHERENCE_NUM; c++)
+    {
+        std::vector<Geometry::Ray> rays = make_rays((Coherence)c, BENCH_BATCH);
+        for (size_t i = 0; i < rays.size(); i++)
+        {
+            Geometry::HitRecord rec;
+            if (sphere.hit(rays[i], 0.001f, FLOAT_INFINITY, rec))
+            {
+                hit_rays[c].push_back(rays[i]);
+                records[c].push_back(rec);
+            }
+        }
+    }
+
+    for (size_t m = 0; m < sizeof(materials) / sizeof(materials[0]); m++)
+    {
+        KernelResult result;
+        result.name = materials[m].name;
+        const Material::Material & material = *materials[m].material;
+        for (int c = 0; c < COHERENCE_NUM; c++)
+        {
+            int count = (int)records[c].size();
+            result.ns[c] = time_ns(BENCH_BATCH, [&](int i) {
+                Geometry::Ray scattered;
+                vec4 attenuation;
+                int k = i % count;
+                return material.scatter(hit_rays[c][k], records[c][k], attenuation, scattered)
+                     ? attenuation.r + scattered.direction().x : 0.0f;
+            });
+        }
+        results.push_back(result);
+    }
+}
+
+void bench_texture(std::vector<KernelResult> & results, const char * filename)
+{
+    FILE * file = fopen(filename, "rb");
+    if (!file)
+    {
+        printf("[WARNING] Skipping ImageTexture::value, no texture at [%s]\n", filename);
+        return;
+    }
+    fclose(file);
+
+    Utility::ImageTexture texture(filename);
+    std::vector<vec2> uvs[COHERENCE_NUM];
+    int side = static_cast<int>(sqrtf((float)BENCH_BATCH));
+    for (int j = 0; j < side; j++)
+    for (int i = 0; i < side; i++)
+    {
+        uvs[COHERENT].push_back(vec2((i + 0.5f) / side * 0.25f, (j + 0.5f) / side * 0.25f));
+    }
+    for (int i = 0; i < BENCH_BATCH; i++)
+    {
+        uvs[RANDOM].push_back(vec2(random_float(), random_float()));
+    }
+
+    KernelResult result;
+    result.name = "ImageTexture::value";
+    for (int c = 0; c < COHERENCE_NUM; c++)
+    {
+        const std::vector<vec2> & batch = uvs[c];
+        result.ns[c] = time_ns((int)batch.size(), [&](int i) {
+            return texture.value(batch[i].x, batch[i].y, vec3(0.0f), 0.0f).g;
+        });
+    }
+    results.push_back(result);
+}
+
+void bench_turb(std::vector<KernelResult> & results)
+{
+    Utility::Perlin perlin;
+    std::vector<vec3> points[COHERENCE_NUM];
+    int side = static_cast<int>(sqrtf((float)BENCH_BATCH));
+    for (int j = 0; j < side; j++)
+    for (int i = 0; i < side; i++)
+    {
+        points[COHERENT].push_back(vec3(i * 0.01f, j * 0.01f, 0.5f));
+    }
+    for (int i = 0; i < BENCH_BATCH; i++)
+    {
+        points[RANDOM].push_back(random_vec3(-10.0f, 10.0f));
+    }
+
+    KernelResult result;
+    result.name = "Perlin::turb";
+    for (int c = 0; c < COHERENCE_NUM; c++)
+    {
+        const std::vector<vec3> & batch = points[c];
+        result.ns[c] = time_ns((int)batch.size(), [&](int i) {
+            return perlin.turb(batch[i]);
+        });
+    }
+    results.push_back(result);
+}
+
+int main(int argc, char * argv[])
+{
+    const char * texture = "assets/texture/earthmap.jpg";
+    const char * output = "microbench.json";
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) output = argv[++i];
+        else texture = argv[i];
+    }
+
+    auto material = make_shared<Material::Lambertian>(vec4(0.5f, 0.5f, 0.5f, 1.0f));
+    auto box = make_shared<Geometry::Box>(vec3(-0.8f), vec3(0.8f), material);
+    Geometry::Rotate rotated(box, quaternion_from_axis_angle(vec3(1.0f, 1.0f, 0.0f), degree_to_radian(30.0f)));
+
+    std::vector<KernelResult> results;
+    bench_aabb(results);
+    bench_hittable(results, "Sphere::hit", Geometry::Sphere(vec3(0.0f), 1.0f, material));
+    bench_hittable(results, "Triangle::hit", Geometry::Triangle(
+        vec3(-1.0f, -1.0f, 0.0f), vec3(1.0f, -1.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f), material));
+    bench_hittable(results, "AxisAlignedRect::hit", Geometry::AxisAlignedRect(
+        -1.0f, 1.0f, -1.0f, 1.0f, 0.0f, Geometry::AxisAlignedRectType::RECT_XY, material));
+    bench_hittable(results, "Box::hit", *box);
+    bench_hittable(results, "Rotate::hit", rotated);
+    bench_materials(results);
+    bench_texture(results, texture);
+    bench_turb(results);
+
+    printf("%-24s %14s %14s\n", "kernel", "coherent ns/op", "random ns/op");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        printf("%-24s %14.2f %14.2f\n", results[i].name.c_str(), results[i].ns[COHERENT], results[i].ns[RANDOM]);
+    }
+
+    FILE * file = fopen(output, "w");
+    if (!file)
+    {
+        printf("[ERROR] Failed to open [%s]\n", output);
+        return -1;
+    }
+    fprintf(file, "{\n  \"kernels\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        fprintf(file, "    {\"name\": \"%s\", \"%s_ns\": %.3f, \"%s_ns\": %.3f}%s\n", results[i].name.c_str(),
+            COHERENCE_NAMES[COHERENT], results[i].ns[COHERENT], COHERENCE_NAMES[RANDOM], results[i].ns[RANDOM],
+            i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    printf("[INFO] Results saved to [%s]\n", output);
+
+    return 0;
+}
@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "global.hpp"
+#include "geometry.hpp"
+#include "camera.hpp"
+#include "scene.hpp"
+#include "render.hpp"
+#include "bench.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Render every built-in scene at a fixed resolution, spp and seed and report
+// BVH build time, primary and secondary ray throughput, frame time and peak
+// memory as JSON, optionally compared with an earlier run. The frame is
+// rendered with trace_pixel() on all OpenMP threads, as the renderer does.
+//
+// Usage: bench [--scene N]... [--height H] [--spp N] [--seed S]
+//              [--output result.json] [--baseline baseline.json]
+// Run from the repository root so the scenes find their assets
+
+#define BENCH_RAY_REPEATS 4
+
+struct BenchConfig
+{
+    int height = 128;
+    int spp = 8;
+    int max_depth = 50;
+    unsigned int seed = 1;
+};
+
+struct SceneResult
+{
+    int scene;
+    int ok;
+    double build_seconds;       // scene setup including asset loading and BVH build
+    double primary_mrays;       // camera rays, closest hit only
+    double secondary_mrays;     // first bounce rays, closest hit only
+    double render_seconds;      // full frame with trace_pixel and camera ray packets
+    long peak_rss_kb;
+};
+
+/**
+ * Best of a few runs of closest hit queries for a batch of rays
+ */
+double trace_mrays(const Geometry::Hittable & world, const std::vector<Geometry::Ray> & rays, int & hits)
+{
+    double best = FLOAT_INFINITY;
+    for (int r = 0; r < BENCH_RAY_REPEATS; r++)
+    {
+        hits = 0;
+        double start = wall_seconds();
+        for (size_t i = 0; i < rays.size(); i++)
+        {
+            Geometry::HitRecord rec;
+            if (world.hit(rays[i], 0.001f, FLOAT_INFINITY, rec)) hits++;
+        }
+        best = MIN(best, wall_seconds() - start);
+    }
+    return rays.size() / best * 1e-6;
+}
+
+SceneResult run_scene(int scene_idx, const BenchConfig & config)
+{
+    SceneResult result;
+    memset(&result, 0, sizeof(result));
+    result.scene = scene_idx;
+
+    // The scene generators and the BVH builder draw from this generator, seeded
+    // as the renderer does so the scenes are the ones users render. The seed
+    // of the config only drives the rays and samples.
+    seed_random(SCENE_SEED);
+    double start = wall_seconds();
+    SceneSetup scene;
+    scene.aspect_ratio = 3.0f / 2.0f;
+    if (!setup_scene(scene_idx, scene)) return result;
+    result.build_seconds = wall_seconds() - start;
+
+    int height = config.height;
+    int width = static_cast<int>(height * scene.aspect_ratio);
+    Scene::Camera camera(scene.eye, scene.at, scene.up, scene.fov, scene.aspect_ratio, 0.1f, 10.0f, 1.0f);
+    camera.set_image_height(height);
+
+    std::vector<Geometry::Ray> primary;
+    primary.reserve(width * height * config.spp);
+    for (int j = 0; j < height; j++)
+    for (int i = 0; i < width; i++)
+    {
+        seed_pixel(config.seed, j * width + i, 0);
+        for (int s = 0; s < config.spp; s++)
+        {
+            float u = ((float)i + random_float()) / (width - 1);
+            float v = ((float)j + random_float()) / (height - 1);
+            primary.push_back(camera.get_ray(u, v));
+        }
+    }
+    int hits;
+    result.primary_mrays = trace_mrays(scene.world, primary, hits);
+
+    // Rays scattered at the primary hits, incoherent for diffuse surfaces
+    std::vector<Geometry::Ray> secondary;
+    seed_random(config.seed);
+    for (size_t i = 0; i < primary.size(); i++)
+    {
+        Geometry::HitRecord rec;
+        Geometry::Ray scattered;
+        vec4 attenuation;
+        if (scene.world.hit(primary[i], 0.001f, FLOAT_INFINITY, rec)
+         && rec.material->scatter(primary[i], rec, attenuation, scattered))
+        {
+            secondary.push_back(scattered);
+        }
+    }
+    result.secondary_mrays = secondary.empty() ? 0.0 : trace_mrays(scene.world, secondary, hits);
+
+    start = wall_seconds();
+    float checksum = 0.0f;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+:checksum)
+#endif
+    for (int j = 0; j < height; j++)
+    for (int i = 0; i < width; i++)
+    {
+        seed_pixel(config.seed, j * width + i, 0);
+        trace_pixel(camera, scene.world, i, j, width, height, config.spp, config.max_depth, true,
+            [&](const vec4 & color) { checksum += luminance(color); });
+    }
+    result.render_seconds = wall_seconds() - start;
+    printf("[INFO] Scene %d: %dx%d, %d spp, %zu secondary rays, checksum %.4f\n",
+        scene_idx, width, height, config.spp, secondary.size(), checksum / (width * height * config.spp));
+
+    result.peak_rss_kb = peak_rss_kb();
+    result.ok = 1;
+    return result;
+}
+
+/**
+ * Run a scene in a child process so its peak memory is its own and a scene
+ * that fails to load does not take the others down
+ */
+SceneResult run_scene_isolated(int scene_idx, const BenchConfig & config)
+{
+#ifdef __linux__
+    int fds[2];
+    if (pipe(fds) == 0)
+    {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(fds[0]);
+            SceneResult result = run_scene(scene_idx, config);
+            ssize_t written = write(fds[1], &result, sizeof(result));
+            fflush(stdout);
+            _exit(written == sizeof(result) ? 0 : 1);
+        }
+        close(fds[1]);
+        SceneResult result;
+        memset(&result, 0, sizeof(result));
+        result.scene = scene_idx;
+        if (pid > 0)
+        {
+            if (read(fds[0], &result, sizeof(result)) != sizeof(result)) result.ok = 0;
+            waitpid(pid, nullptr, 0);
+        }
+        close(fds[0]);
+        return result;
+    }
+#endif
+    return run_scene(scene_idx, config);
+}
+
+void write_result(FILE * file, const SceneResult & r)
+{
+    fprintf(file, "{\"scene\": %d, \"build_seconds\": %.6f, \"primary_mrays\": %.4f, \"secondary_mrays\": %.4f, "
+                  "\"render_seconds\": %.6f, \"peak_rss_kb\": %ld}",
+        r.scene, r.build_seconds, r.primary_mrays, r.secondary_mrays, r.render_seconds, r.peak_rss_kb);
+}
+
+/**
+ * Read the scenes of a file written by this benchmark, one scene per line
+ */
+std::vector<SceneResult> read_results(const char * filename)
+{
+    std::vector<SceneResult> results;
+    FILE * file = fopen(filename, "r");
+    if (!file)
+    {
+        printf("[ERROR] Failed to open [%s]\n", filename);
+        return results;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), file))
+    {
+        const char * entry = strstr(line, "{\"scene\"");
+        SceneResult r;
+        if (entry && sscanf(entry, "{\"scene\": %d, \"build_seconds\": %lf, \"primary_mrays\": %lf, \"secondary_mrays\": %lf, "
+                                   "\"render_seconds\": %lf, \"peak_rss_kb\": %ld}",
+                            &r.scene, &r.build_seconds, &r.primary_mrays, &r.secondary_mrays,
+                            &r.render_seconds, &r.peak_rss_kb) == 6)
+        {
+            r.ok = 1;
+            results.push_back(r);
+        }
+    }
+    fclose(file);
+    return results;
+}
+
+void print_change(const char * name, double baseline, double current, bool higher_is_better)
+{
+    double change = baseline != 0.0 ? (current - baseline) / baseline * 100.0 : 0.0;
+    bool better = higher_is_better ? change > 0.0 : change < 0.0;
+    printf("  %-16s %12.4f -> %12.4f  %+7.2f%% %s\n", name, baseline, current, change,
+        fabs(change) < 2.0 ? "" : better ? "(better)" : "(worse)");
+}
+
+void compare(const std::vector<SceneResult> & baseline, const std::vector<SceneResult> & results)
+{
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const SceneResult & r = results[i];
+        for (size_t k = 0; k < baseline.size(); k++)
+        {
+            const SceneResult & b = baseline[k];
+            if (b.scene != r.scene || !r.ok) continue;
+            printf("[INFO] Scene %d against baseline:\n", r.scene);
+            print_change("build_seconds", b.build_seconds, r.build_seconds, false);
+            print_change("primary_mrays", b.primary_mrays, r.primary_mrays, true);
+            print_change("secondary_mrays", b.secondary_mrays, r.secondary_mrays, true);
+            print_change("render_seconds", b.render_seconds, r.render_seconds, false);
+            print_change("peak_rss_kb", (double)b.peak_rss_kb, (double)r.peak_rss_kb, false);
+        }
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    BenchConfig config;
+    std::vector<int> scenes;
+    const char * output = "bench.json";
+    const char * baseline = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = i + 1 < argc;
+        if (has_value && strcmp(argv[i], "--scene") == 0) scenes.push_back(atoi(argv[++i]));
+        else if (has_value && strcmp(argv[i], "--height") == 0) config.height = atoi(argv[++i]);
+        else if (has_value && strcmp(argv[i], "--spp") == 0) config.spp = atoi(argv[++i]);
+        else if (has_value && strcmp(argv[i], "--seed") == 0) config.seed = (unsigned int)atoi(argv[++i]);
+        else if (has_value && strcmp(argv[i], "--output") == 0) output = argv[++i];
+        else if (has_value && strcmp(argv[i], "--baseline") == 0) baseline = argv[++i];
+        else
+        {
+            printf("[ERROR] Unknown argument [%s]\n", argv[i]);
+            return -1;
+        }
+    }
+    if (scenes.empty())
+    {
+        for (int i = 0; i < SCENE_NUM; i++) scenes.push_back(i);
+    }
+
+    std::vector<SceneResult> results;
+    for (size_t i = 0; i < scenes.size(); i++)
+    {
+        SceneResult result = run_scene_isolated(scenes[i], config);
+        if (!result.ok)
+        {
+            printf("[WARNING] Scene %d failed\n", scenes[i]);
+            continue;
+        }
+        results.push_back(result);
+    }
+
+    FILE * file = fopen(output, "w");
+    if (!file)
+    {
+        printf("[ERROR] Failed to open [%s]\n", output);
+        return -1;
+    }
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    fprintf(file, "{\n  \"config\": {\"height\": %d, \"spp\": %d, \"max_depth\": %d, \"seed\": %u, "
+                  "\"threads\": %d},\n  \"scenes\": [\n",
+        config.height, config.spp, config.max_depth, config.seed, threads);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        fprintf(file, "    ");
+        write_result(file, results[i]);
+        fprintf(file, i + 1 < results.size() ? ",\n" : "\n");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    printf("[INFO] Results saved to [%s]\n", output);
+
+    if (baseline)
+    {
+        compare(read_results(baseline), results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <vector>
+#include "global.hpp"
+#include "image.hpp"
+#include "bench.hpp"
+
+// Compare bilinear sampling throughput and cache misses of the linear and the
+// tiled texel layout of Utility::CompactImage
+//
+// Usage: bench_texture [texture files...]
+
+#define BENCH_LOOKUPS (1 << 22)
+#define BENCH_REPEATS 4
+
+struct Result
+{
+    double samples_per_second;
+    long long cache_misses;
+    float checksum;
+};
+
+/**
+ * Lookups walking scanlines of a screen over a rotated patch of the
+ * texture, as primary rays hitting a textured surface would
+ */
+std::vector<vec2> coherent_lookups(int count)
+{
+    std::vector<vec2> uvs;
+    uvs.reserve(count);
+    int side = static_cast<int>(sqrtf((float)count));
+    float angle = degree_to_radian(30.0f);
+    vec2 du(cosf(angle) / side, sinf(angle) / side);
+    vec2 dv(-sinf(angle) / side, cosf(angle) / side);
+
+    for (int j = 0; j < side; j++)
+    for (int i = 0; i < side; i++)
+    {
+        vec2 uv = vec2(0.5f, 0.0f) + du * (float)i + dv * (float)j;
+        uvs.push_back(vec2(uv.x - floorf(uv.x), uv.y - floorf(uv.y)));
+    }
+    return uvs;
+}
+
+/**
+ * Uniformly random lookups, as incoherent secondary rays would
+ */
+std::vector<vec2> random_lookups(int count)
+{
+    std::vector<vec2> uvs;
+    uvs.reserve(count);
+    for (int i = 0; i < count; i++)
+    {
+        uvs.push_back(vec2(random_float(), random_float()));
+    }
+    return uvs;
+}
+
+Result run(const Utility::CompactImage & image, const std::vector<vec2> & uvs)
+{
+    CacheMissCounter counter;
+    Result result;
+    result.checksum = 0.0f;
+
+    counter.start();
+    double start = wall_seconds();
+    for (int r = 0; r < BENCH_REPEATS; r++)
+    {
+        for (size_t i = 0; i < uvs.size(); i++)
+        {
+            result.checksum += image.sample(uvs[i]).g;
+        }
+    }
+    double duration = wall_seconds() - start;
+    result.cache_misses = counter.stop();
+    result.samples_per_second = uvs.size() * BENCH_REPEATS / duration;
+
+    return result;
+}
+
+int main(int argc, char * argv[])
+{
+    std::vector<const char *> files;
+    for (int i = 1; i < argc; i++)
+    {
+        files.push_back(argv[i]);
+    }
+    if (files.empty())
+    {
+        files.push_back("assets/texture/earthmap.jpg");
+        files.push_back("assets/texture/brickwall.bmp");
+    }
+
+    const char * layout_names[] = { "linear", "tiled" };
+    Utility::ImageLayout layouts[] = { Utility::LAYOUT_LINEAR, Utility::LAYOUT_TILED };
+
+    std::vector<vec2> lookups[2] = { coherent_lookups(BENCH_LOOKUPS), random_lookups(BENCH_LOOKUPS) };
+    const char * lookup_names[] = { "coherent", "random" };
+
+    printf("%-32s %-8s %-10s %14s %18s\n", "texture", "layout", "lookups", "Msamples/s", "cache misses/op");
+    for (size_t f = 0; f < files.size(); f++)
+    {
+        for (int l = 0; l < 2; l++)
+        {
+            Utility::CompactImage image(files[f], layouts[l]);
+            for (int p = 0; p < 2; p++)
+            {
+                Result result = run(image, lookups[p]);
+                printf("%-32s %-8s %-10s %14.2f ", files[f], layout_names[l], lookup_names[p],
+                    result.samples_per_second * 1e-6);
+                if (result.cache_misses >= 0)
+                    printf("%18.4f\n", (double)result.cache_misses / (lookups[p].size() * BENCH_REPEATS));
+                else
+                    printf("%18s\n", "n/a");
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,212 @@
+#ifndef __ARENA_HPP__
+#define __ARENA_HPP__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+#include "memory.hpp"
+
+// Size of the first block of a pool, later blocks double up to the largest size
+#define ARENA_FIRST_BLOCK (4 << 10)
+#define ARENA_MAX_BLOCK (1 << 20)
+
+namespace Utility
+{
+
+/**
+ * Monotonic allocator for the objects of a scene. Every type has a pool of
+ * its own, so objects of a type are packed together in memory. Nothing is
+ * freed one by one; the arena releases all of its blocks when it goes away.
+ */
+class Arena
+{
+private:
+    struct Pool
+    {
+        char * cursor;
+        size_t left;
+        size_t block_size;
+
+        Pool(): cursor(nullptr), left(0), block_size(ARENA_FIRST_BLOCK) {}
+    };
+
+    std::vector<Pool> m_pools;
+    std::vector<void *> m_blocks;
+    std::mutex m_mutex;
+    size_t m_used;
+    size_t m_reserved;
+    size_t m_objects;
+    // What was counted towards the memory statistics, taken back with the blocks
+    size_t m_category_bytes[MEMORY_CATEGORY_NUM];
+    size_t m_category_count[MEMORY_CATEGORY_NUM];
+
+    static size_t next_type_id()
+    {
+        static std::atomic<size_t> next(0);
+        return next++;
+    }
+
+    template <typename T>
+    static size_t type_id()
+    {
+        static const size_t id = next_type_id();
+        return id;
+    }
+
+    static size_t padding(const char * cursor, size_t alignment)
+    {
+        return (alignment - (uintptr_t)cursor % alignment) % alignment;
+    }
+
+    void count(MemoryCategory category, size_t bytes)
+    {
+        m_category_bytes[category] += bytes;
+        m_category_count[category]++;
+        memory_stats().add(category, bytes);
+    }
+
+    void * allocate(size_t pool_id, size_t size, size_t alignment, MemoryCategory category, size_t object_size)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // Whatever comes with the object, the shared_ptr control block if
+        // it is made by allocate_shared()
+        count(category, object_size);
+        if (size > object_size) count(MEMORY_CONTROL_BLOCKS, size - object_size);
+
+        if (pool_id >= m_pools.size()) m_pools.resize(pool_id + 1);
+        Pool & pool = m_pools[pool_id];
+        if (!pool.cursor || padding(pool.cursor, alignment) + size > pool.left)
+        {
+            size_t block_size = std::max(pool.block_size, size + alignment);
+            char * block = (char *)malloc(block_size);
+            if (!block) throw std::bad_alloc();
+            m_blocks.push_back(block);
+            m_reserved += block_size;
+            pool.cursor = block;
+            pool.left = block_size;
+            pool.block_size = std::min(pool.block_size * 2, (size_t)ARENA_MAX_BLOCK);
+        }
+        size_t skip = padding(pool.cursor, alignment);
+        char * result = pool.cursor + skip;
+        pool.cursor += skip + size;
+        pool.left -= skip + size;
+        m_used += size;
+        m_objects++;
+        return result;
+    }
+
+public:
+    Arena(): m_used(0), m_reserved(0), m_objects(0)
+    {
+        for (int i = 0; i < MEMORY_CATEGORY_NUM; i++)
+        {
+            m_category_bytes[i] = 0;
+            m_category_count[i] = 0;
+        }
+    }
+
+    Arena(const Arena &) = delete;
+    Arena & operator=(const Arena &) = delete;
+
+    ~Arena()
+    {
+        for (size_t i = 0; i < m_blocks.size(); i++) free(m_blocks[i]);
+        for (int i = 0; i < MEMORY_CATEGORY_NUM; i++)
+        {
+            memory_stats().remove((MemoryCategory)i, m_category_bytes[i], m_category_count[i]);
+        }
+    }
+
+    /**
+     * Room for count objects of type T holding an object of object_size
+     * bytes of the given category
+     */
+    template <typename T>
+    T * allocate(size_t count, MemoryCategory category, size_t object_size)
+    {
+        return static_cast<T *>(allocate(type_id<T>(), sizeof(T) * count, alignof(T), category, object_size));
+    }
+
+    size_t used() const { return m_used; }
+    size_t reserved() const { return m_reserved; }
+    size_t objects() const { return m_objects; }
+};
+
+/**
+ * Standard allocator on an arena, deallocation is left to the arena. Holds a
+ * reference to the arena, so objects kept past their scene keep its blocks.
+ */
+template <typename T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+
+    std::shared_ptr<Arena> arena;
+    MemoryCategory category;
+    size_t object_size;
+
+    ArenaAllocator(const std::shared_ptr<Arena> & arena, MemoryCategory category, size_t object_size):
+        arena(arena), category(category), object_size(object_size) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> & other):
+        arena(other.arena), category(other.category), object_size(other.object_size) {}
+
+    T * allocate(size_t count) { return arena->allocate<T>(count, category, object_size); }
+    void deallocate(T *, size_t) {}
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> & a, const ArenaAllocator<U> & b) { return a.arena == b.arena; }
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> & a, const ArenaAllocator<U> & b) { return a.arena != b.arena; }
+
+/**
+ * Arena that scene objects are allocated from, null outside of scene construction
+ */
+inline std::shared_ptr<Arena> & scene_arena()
+{
+    static std::shared_ptr<Arena> arena;
+    return arena;
+}
+
+/**
+ * Makes make_scene_shared() allocate from arena while in scope. Scenes are
+ * built one at a time, though their loaders may use several threads.
+ */
+class ArenaScope
+{
+private:
+    std::shared_ptr<Arena> m_previous;
+
+public:
+    ArenaScope(const std::shared_ptr<Arena> & arena): m_previous(scene_arena()) { scene_arena() = arena; }
+    ~ArenaScope() { scene_arena() = m_previous; }
+};
+
+/**
+ * make_shared() for scene objects, the object and its control block share
+ * one allocation from the scene arena if there is one
+ */
+template <typename T, typename... Args>
+std::shared_ptr<T> make_scene_shared(Args &&... args)
+{
+    const std::shared_ptr<Arena> & arena = scene_arena();
+    if (arena)
+    {
+        ArenaAllocator<T> allocator(arena, memory_category(static_cast<T *>(nullptr)), sizeof(T));
+        return std::allocate_shared<T>(allocator, std::forward<Args>(args)...);
+    }
+    return std::make_shared<T>(std::forward<Args>(args)...);
+}
+
+} // namespace Utility
+
+#endif
@@ -18,6 +18,8 @@ private:
     vec3 m_u, m_v, m_w;
     float m_lens_radius;
     float m_shutter_speed;
+    float m_viewport_h;
+    float m_pixel_spread;
 
 public:
     Camera(
@@ -48,6 +50,18 @@ public:
         m_lens_radius = aperture * 0.5f;
 
         m_shutter_speed = shutter_speed;
+
+        m_viewport_h = viewport_h;
+        m_pixel_spread = 0.0f;
+    }
+
+    /**
+     * Set the angle covered by a pixel, which primary rays
+     * start their footprint with for texture filtering
+     */
+    void set_image_height(int height)
+    {
+        m_pixel_spread = m_viewport_h / height;
     }
 
     Geometry::Ray get_ray(float s, float t) const
@@ -58,7 +72,9 @@ public:
         return Geometry::Ray(
             m_origin + offset, 
             m_lower_left_corner + s * m_horizontal + t * m_vertical - m_origin - offset,
-            random_float(0.0f, m_shutter_speed)
+            random_float(0.0f, m_shutter_speed),
+            0.0f,
+            m_pixel_spread
         );
     }
 };
@@ -0,0 +1,256 @@
+#ifndef __CHECKPOINT_HPP__
+#define __CHECKPOINT_HPP__
+
+#include <stdio.h>
+#include <string.h>
+#include <climits>
+#include <vector>
+#include <string>
+#include "global.hpp"
+#include "image.hpp"
+#include "memory.hpp"
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define CHECKPOINT_MAGIC "RTCKPT2"
+
+namespace Utility
+{
+
+/**
+ * Push the written data of a file to the disk
+ */
+inline bool sync_file(FILE * file)
+{
+    if (fflush(file) != 0) return false;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+/**
+ * Make a rename in the directory of filename durable, nothing to do on Windows
+ */
+inline void sync_directory(const char * filename)
+{
+#ifndef _WIN32
+    std::string path(filename);
+    size_t slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int fd = open(directory.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+#else
+    (void)filename;
+#endif
+}
+
+/**
+ * Per-pixel radiance sums and sample counts of a render in progress.
+ * Samples of a pixel continue from a generator seeded by (seed, pixel,
+ * samples so far), so samples added after a resume never repeat the
+ * ones already taken.
+ */
+class Accumulator
+{
+private:
+    int m_width;
+    int m_height;
+    unsigned int m_seed;
+    template <typename T>
+    using Buffer = std::vector<T, CountedAllocator<T, MEMORY_FRAMEBUFFER> >;
+
+    Buffer<float> m_sums;       // rgb per pixel
+    Buffer<float> m_sq_sums;    // luminance squared per pixel, for the noise estimate
+    Buffer<int> m_counts;
+
+public:
+    Accumulator(): m_width(0), m_height(0), m_seed(0) {}
+
+    Accumulator(int width, int height, unsigned int seed = 0):
+        m_width(width),
+        m_height(height),
+        m_seed(seed),
+        m_sums(width * height * 3, 0.0f),
+        m_sq_sums(width * height, 0.0f),
+        m_counts(width * height, 0)
+    {}
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    unsigned int seed() const { return m_seed; }
+    int count(int x, int y) const { return m_counts[y * m_width + x]; }
+
+    /**
+     * Seed this thread's generator for the next samples of pixel (x, y)
+     */
+    void seed_pixel(int x, int y) const
+    {
+        unsigned int pixel = y * m_width + x;
+        ::seed_pixel(m_seed, pixel, m_counts[pixel]);
+    }
+
+    void add(int x, int y, const vec4 & color)
+    {
+        int pixel = y * m_width + x;
+        float l = luminance(color);
+        m_sums[pixel * 3 + 0] += color.r;
+        m_sums[pixel * 3 + 1] += color.g;
+        m_sums[pixel * 3 + 2] += color.b;
+        m_sq_sums[pixel] += l * l;
+        m_counts[pixel]++;
+    }
+
+    /**
+     * Add samples taken elsewhere, given as their rgb and luminance squared sums
+     */
+    void merge(int x, int y, const float * sums, float sq_sum, int count)
+    {
+        int pixel = y * m_width + x;
+        m_sums[pixel * 3 + 0] += sums[0];
+        m_sums[pixel * 3 + 1] += sums[1];
+        m_sums[pixel * 3 + 2] += sums[2];
+        m_sq_sums[pixel] += sq_sum;
+        m_counts[pixel] += count;
+    }
+
+    vec4 average(int x, int y) const
+    {
+        int pixel = y * m_width + x;
+        float k = m_counts[pixel] > 0 ? 1.0f / m_counts[pixel] : 0.0f;
+        return vec4(m_sums[pixel * 3 + 0] * k, m_sums[pixel * 3 + 1] * k, m_sums[pixel * 3 + 2] * k, 1.0f);
+    }
+
+    int min_count() const
+    {
+        int result = INT_MAX;
+        for (size_t i = 0; i < m_counts.size(); i++) result = MIN(result, m_counts[i]);
+        return result;
+    }
+
+    /**
+     * Mean standard error of the pixel luminances relative to the mean
+     * luminance of the image, pixels with less than 2 samples are skipped
+     */
+    float noise() const
+    {
+        double error = 0.0, mean = 0.0;
+        int n = 0;
+        for (size_t i = 0; i < m_counts.size(); i++)
+        {
+            int count = m_counts[i];
+            if (count < 2) continue;
+            float l = luminance(vec4(m_sums[i * 3 + 0], m_sums[i * 3 + 1], m_sums[i * 3 + 2], 0.0f)) / count;
+            float variance = MAX(m_sq_sums[i] / count - l * l, 0.0f) * count / (count - 1);
+            error += sqrtf(variance / count);
+            mean += l;
+            n++;
+        }
+        if (n == 0 || mean <= 0.0) return FLOAT_INFINITY;
+        return (float)(error / mean);
+    }
+
+    /**
+     * Average of the samples so far, pixels without samples are black
+     */
+    void resolve(Image & image) const
+    {
+        for (int y = 0; y < m_height; y++)
+        for (int x = 0; x < m_width; x++)
+        {
+            vec4 color = average(x, y);
+            image(x, y, 0) = color.r;
+            image(x, y, 1) = color.g;
+            image(x, y, 2) = color.b;
+        }
+    }
+
+    /**
+     * Written to a temporary file first and renamed over the old
+     * checkpoint, so a kill mid-write leaves the previous one intact
+     */
+    bool save(const char * filename) const
+    {
+        std::string temp = std::string(filename) + ".tmp";
+        FILE * file = fopen(temp.c_str(), "wb");
+        if (!file)
+        {
+            printf("[ERROR] Failed to open [%s]\n", temp.c_str());
+            return false;
+        }
+
+        bool ok = fwrite(CHECKPOINT_MAGIC, 1, sizeof(CHECKPOINT_MAGIC), file) == sizeof(CHECKPOINT_MAGIC)
+               && fwrite(&m_width, sizeof(int), 1, file) == 1
+               && fwrite(&m_height, sizeof(int), 1, file) == 1
+               && fwrite(&m_seed, sizeof(unsigned int), 1, file) == 1
+               && fwrite(m_counts.data(), sizeof(int), m_counts.size(), file) == m_counts.size()
+               && fwrite(m_sums.data(), sizeof(float), m_sums.size(), file) == m_sums.size()
+               && fwrite(m_sq_sums.data(), sizeof(float), m_sq_sums.size(), file) == m_sq_sums.size();
+        // On disk before it replaces the last checkpoint, or a crash could leave neither
+        ok = ok && sync_file(file);
+        ok = (fclose(file) == 0) && ok;
+        if (!ok)
+        {
+            printf("[ERROR] Failed to write checkpoint [%s]\n", temp.c_str());
+            remove(temp.c_str());
+            return false;
+        }
+
+#ifdef _WIN32
+        remove(filename);
+#endif
+        if (rename(temp.c_str(), filename) != 0)
+        {
+            printf("[ERROR] Failed to replace checkpoint [%s]\n", filename);
+            return false;
+        }
+        sync_directory(filename);
+        return true;
+    }
+
+    /**
+     * Returns false if the file is missing or not a checkpoint
+     */
+    bool load(const char * filename)
+    {
+        FILE * file = fopen(filename, "rb");
+        if (!file) return false;
+
+        char magic[sizeof(CHECKPOINT_MAGIC)];
+        int width, height;
+        unsigned int seed;
+        bool ok = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+               && memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0
+               && fread(&width, sizeof(int), 1, file) == 1
+               && fread(&height, sizeof(int), 1, file) == 1
+               && fread(&seed, sizeof(unsigned int), 1, file) == 1
+               && width > 0 && height > 0;
+        if (ok)
+        {
+            m_width = width;
+            m_height = height;
+            m_seed = seed;
+            m_counts.resize(width * height);
+            m_sums.resize(width * height * 3);
+            m_sq_sums.resize(width * height);
+            ok = fread(m_counts.data(), sizeof(int), m_counts.size(), file) == m_counts.size()
+              && fread(m_sums.data(), sizeof(float), m_sums.size(), file) == m_sums.size()
+              && fread(m_sq_sums.data(), sizeof(float), m_sq_sums.size(), file) == m_sq_sums.size();
+        }
+        fclose(file);
+
+        if (!ok) printf("[ERROR] Invalid checkpoint [%s]\n", filename);
+        return ok;
+    }
+};
+
+} // namespace Utility
+
+#endif
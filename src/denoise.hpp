@@ -0,0 +1,120 @@
+#ifndef __DENOISE_HPP__
+#define __DENOISE_HPP__
+
+#include <vector>
+#include "global.hpp"
+#include "image.hpp"
+
+// Filter passes, the taps of pass i are 2^i pixels apart
+#define ATROUS_PASSES 5
+// Albedo channels below this are not divided out of the colour
+#define ATROUS_MIN_ALBEDO 0.01f
+
+namespace Utility
+{
+
+/**
+ * Edge-avoiding À-Trous wavelet filter (Dammertz et al. 2010) guided by
+ * first hit buffers. Colour is divided by albedo before filtering and
+ * multiplied back after, so textures stay sharp; the 5x5 B3 spline taps
+ * are weighted down across normal and depth edges and between different
+ * irradiance. Depth 0 marks pixels whose camera rays hit nothing.
+ */
+Image atrous_filtering(const Image & color, const Image & albedo, const Image & normal, const Image & depth,
+                       int passes, float sigma_color, float sigma_normal, float sigma_depth)
+{
+    static const float kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+    double start_timestamp = wall_seconds();
+    int width = color.width();
+    int height = color.height();
+    int count = width * height;
+
+    std::vector<vec3> irradiance(count);
+    std::vector<vec3> albedos(count);
+    std::vector<vec3> normals(count);
+    std::vector<float> depths(count);
+    for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+    {
+        int p = y * width + x;
+        for (int c = 0; c < 3; c++)
+        {
+            float a = albedo.pixel_at(x, y, c);
+            albedos[p][c] = a > ATROUS_MIN_ALBEDO ? a : 1.0f;
+            irradiance[p][c] = color.pixel_at(x, y, c) / albedos[p][c];
+            normals[p][c] = normal.pixel_at(x, y, c);
+        }
+        depths[p] = depth.pixel_at(x, y, 0);
+    }
+
+    std::vector<vec3> filtered(count);
+    for (int pass = 0; pass < passes; pass++)
+    {
+        int step = 1 << pass;
+        // Later passes average already smooth values, so they tolerate less difference
+        float sigma = sigma_color / step;
+        float inv_sigma2 = 1.0f / (sigma * sigma);
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+        {
+            int p = y * width + x;
+            bool p_hit = depths[p] > 0.0f;
+            float depth_scale = p_hit ? 1.0f / (sigma_depth * step * depths[p]) : 0.0f;
+            vec3 sum(0.0f);
+            float weight_sum = 0.0f;
+            for (int k_y = -2; k_y <= 2; k_y++)
+            {
+                int q_y = y + k_y * step;
+                if (q_y < 0 || q_y >= height) continue;
+                for (int k_x = -2; k_x <= 2; k_x++)
+                {
+                    int q_x = x + k_x * step;
+                    if (q_x < 0 || q_x >= width) continue;
+                    int q = q_y * width + q_x;
+                    if (p_hit != (depths[q] > 0.0f)) continue;
+
+                    vec3 difference = irradiance[q] - irradiance[p];
+                    float weight = kernel[k_x + 2] * kernel[k_y + 2]
+                                 * expf(-glm::dot(difference, difference) * inv_sigma2);
+                    if (p_hit)
+                    {
+                        weight *= powf(MAX(glm::dot(normals[p], normals[q]), 0.0f), sigma_normal)
+                                * expf(-fabsf(depths[q] - depths[p]) * depth_scale);
+                    }
+                    sum += weight * irradiance[q];
+                    weight_sum += weight;
+                }
+            }
+            // A hit pixel without a normal gets no weight even from itself
+            filtered[p] = weight_sum > 0.0f ? sum / weight_sum : irradiance[p];
+        }
+        irradiance.swap(filtered);
+    }
+
+    Image result(width, height, color.channels());
+    for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+    {
+        int p = y * width + x;
+        for (int c = 0; c < 3; c++)
+        {
+            result(x, y, c) = irradiance[p][c] * albedos[p][c];
+        }
+        if (color.channels() == 4) result(x, y, 3) = color.pixel_at(x, y, 3);
+    }
+
+    char total_time[DURATION_STR_LENGTH];
+    get_duration_str((float)(wall_seconds() - start_timestamp), total_time);
+    printf("[INFO] A-Trous filtering time: %s\n", total_time);
+
+    return result;
+}
+
+} // namespace Utility
+
+#endif
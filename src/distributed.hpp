@@ -0,0 +1,383 @@
+#ifndef __DISTRIBUTED_HPP__
+#define __DISTRIBUTED_HPP__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "global.hpp"
+#include "camera.hpp"
+#include "scene.hpp"
+#include "scene_file.hpp"
+#include "render.hpp"
+#include "checkpoint.hpp"
+#include "trace.hpp"
+#ifdef __linux__
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Frame distribution over TCP. The coordinator splits the frame into tiles
+// and sample ranges and hands them to workers running the same renderer:
+//
+//   worker -> coordinator   hello
+//   coordinator -> worker   job <width> <height> <max depth> <seed> <scene>
+//   coordinator -> worker   tile <id> <x> <y> <width> <height> <first sample> <samples>
+//   worker -> coordinator   result <id>, then rgb and luminance squared sums per pixel as floats
+//   coordinator -> worker   done
+//
+// Work in flight on a worker that disconnects or times out goes back to the
+// queue. Workers load the scene themselves, so scene files must be at the same
+// path on every node, and all machines must share the float byte order.
+
+#define DISTRIBUTED_TILE_SIZE 32
+// Samples per work item, so a few large tiles still spread over many workers
+#define DISTRIBUTED_SAMPLES 64
+// Seconds to wait for a result before giving up on a worker
+#define DISTRIBUTED_TIMEOUT 600
+#define DISTRIBUTED_LINE_LENGTH 1024
+
+struct WorkItem
+{
+    int id;
+    int x, y, width, height;
+    int first_sample, samples;
+};
+
+#ifdef __linux__
+
+/**
+ * Hands out the work items of one frame and merges the results
+ */
+class Coordinator
+{
+private:
+    std::string m_scene;
+    int m_width, m_height, m_max_depth;
+    unsigned int m_seed;
+    Utility::Accumulator & m_accumulator;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<WorkItem> m_queue;
+    int m_remaining;
+    int m_total;
+    int m_workers;
+
+    bool take(WorkItem & item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        // Items in flight elsewhere may still come back if their worker dies
+        m_condition.wait(lock, [&]() { return !m_queue.empty() || m_remaining == 0; });
+        if (m_remaining == 0) return false;
+        item = m_queue.front();
+        m_queue.pop_front();
+        return true;
+    }
+
+    void requeue(const WorkItem & item)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_front(item);
+        m_condition.notify_one();
+    }
+
+    void complete(const WorkItem & item, const std::vector<float> & payload)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (int y = 0; y < item.height; y++)
+        for (int x = 0; x < item.width; x++)
+        {
+            const float * pixel = &payload[(y * item.width + x) * 4];
+            m_accumulator.merge(item.x + x, item.y + y, pixel, pixel[3], item.samples);
+        }
+        m_remaining--;
+        printf("\r[INFO] Work items remaining: % 6d / %d, workers: %d    ", m_remaining, m_total, m_workers);
+        fflush(stdout);
+        if (m_remaining == 0) m_condition.notify_all();
+    }
+
+    void serve_worker(int client)
+    {
+        TRACE_SCOPE("worker connection");
+        timeval timeout = { DISTRIBUTED_TIMEOUT, 0 };
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        FILE * in = fdopen(client, "r");
+        FILE * out = fdopen(dup(client), "w");
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_workers++;
+        }
+
+        char line[DISTRIBUTED_LINE_LENGTH];
+        if (fgets(line, sizeof(line), in) && strncmp(line, "hello", 5) == 0)
+        {
+            // The scene goes last, its path may have spaces
+            fprintf(out, "job %d %d %d %u %s\n", m_width, m_height, m_max_depth, m_seed, m_scene.c_str());
+            fflush(out);
+
+            WorkItem item;
+            std::vector<float> payload;
+            bool lost = false;
+            while (!lost && take(item))
+            {
+                fprintf(out, "tile %d %d %d %d %d %d %d\n", item.id, item.x, item.y, item.width, item.height,
+                    item.first_sample, item.samples);
+                fflush(out);
+                payload.resize(item.width * item.height * 4);
+                int id;
+                bool ok = !ferror(out)
+                       && fgets(line, sizeof(line), in) && sscanf(line, "result %d", &id) == 1 && id == item.id
+                       && fread(payload.data(), sizeof(float), payload.size(), in) == payload.size();
+                if (!ok)
+                {
+                    printf("\n[WARNING] Lost a worker, requeueing work item %d\n", item.id);
+                    requeue(item);
+                    lost = true;
+                    continue;
+                }
+                complete(item, payload);
+            }
+            if (!lost)
+            {
+                fprintf(out, "done\n");
+                fflush(out);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_workers--;
+        }
+        fclose(out);
+        fclose(in);
+    }
+
+public:
+    Coordinator(const std::string & scene, int max_depth, int samples_per_pixel, Utility::Accumulator & accumulator):
+        m_scene(scene),
+        m_width(accumulator.width()),
+        m_height(accumulator.height()),
+        m_max_depth(max_depth),
+        m_seed(accumulator.seed()),
+        m_accumulator(accumulator),
+        m_workers(0)
+    {
+        int id = 0;
+        for (int y = 0; y < m_height; y += DISTRIBUTED_TILE_SIZE)
+        for (int x = 0; x < m_width; x += DISTRIBUTED_TILE_SIZE)
+        for (int s = 0; s < samples_per_pixel; s += DISTRIBUTED_SAMPLES)
+        {
+            WorkItem item = { id++, x, y, MIN(DISTRIBUTED_TILE_SIZE, m_width - x), MIN(DISTRIBUTED_TILE_SIZE, m_height - y),
+                              s, MIN(DISTRIBUTED_SAMPLES, samples_per_pixel - s) };
+            m_queue.push_back(item);
+        }
+        m_remaining = m_total = (int)m_queue.size();
+    }
+
+    /**
+     * Accept workers on a TCP port until every work item is merged
+     */
+    bool run(int port)
+    {
+        // A worker gone mid-write must not take the coordinator down
+        signal(SIGPIPE, SIG_IGN);
+        int server = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if (server < 0 || bind(server, (sockaddr *)&address, sizeof(address)) != 0 || listen(server, 64) != 0)
+        {
+            printf("[ERROR] Failed to listen on port [%d]\n", port);
+            if (server >= 0) close(server);
+            return false;
+        }
+        printf("[INFO] Coordinator waiting for workers on port [%d], %d work items\n", port, m_total);
+        fflush(stdout);
+
+        std::vector<std::thread> connections;
+        while (true)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_remaining == 0) break;
+            }
+            pollfd listener = { server, POLLIN, 0 };
+            if (poll(&listener, 1, 200) <= 0) continue;
+            int client = accept(server, nullptr, nullptr);
+            if (client >= 0) connections.push_back(std::thread(&Coordinator::serve_worker, this, client));
+        }
+        close(server);
+        for (size_t i = 0; i < connections.size(); i++) connections[i].join();
+        printf("\n");
+        return true;
+    }
+};
+
+/**
+ * Connect to a coordinator at host:port and render its work items until
+ * it says done, retrying the connection for a while so workers may start first
+ */
+bool run_worker(const char * address)
+{
+    std::string host(address);
+    size_t colon = host.rfind(':');
+    if (colon == std::string::npos)
+    {
+        printf("[ERROR] Coordinator address must be host:port, got [%s]\n", address);
+        return false;
+    }
+    std::string port = host.substr(colon + 1);
+    host = host.substr(0, colon);
+
+    int client = -1;
+    for (int attempt = 0; attempt < 100 && client < 0; attempt++)
+    {
+        addrinfo hints, * result;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) == 0)
+        {
+            for (addrinfo * a = result; a && client < 0; a = a->ai_next)
+            {
+                client = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if (client >= 0 && connect(client, a->ai_addr, a->ai_addrlen) != 0)
+                {
+                    close(client);
+                    client = -1;
+                }
+            }
+            freeaddrinfo(result);
+        }
+        if (client < 0) usleep(100000);
+    }
+    if (client < 0)
+    {
+        printf("[ERROR] Failed to connect to coordinator [%s]\n", address);
+        return false;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    int no_delay = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    FILE * in = fdopen(client, "r");
+    FILE * out = fdopen(dup(client), "w");
+    fprintf(out, "hello\n");
+    fflush(out);
+
+    char line[DISTRIBUTED_LINE_LENGTH];
+    std::string scene_key;
+    int width, height, max_depth;
+    unsigned int seed;
+    int scene_offset = 0;
+    SceneSetup setup;
+    bool ok = fgets(line, sizeof(line), in)
+           && sscanf(line, "job %d %d %d %u %n", &width, &height, &max_depth, &seed, &scene_offset) == 4
+           && scene_offset > 0;
+    if (ok)
+    {
+        // The rest of the line is the scene number or file path
+        line[strcspn(line, "\r\n")] = '\0';
+        scene_key = line + scene_offset;
+        ok = !scene_key.empty();
+    }
+    if (ok)
+    {
+        // Same generator state as the coordinator when it built the scene
+        seed_random(SCENE_SEED);
+        char * end;
+        long index = strtol(scene_key.c_str(), &end, 10);
+        ok = *end == '\0' ? setup_scene((int)index, setup) : Scene::load_scene_file(scene_key.c_str(), setup);
+    }
+    if (!ok)
+    {
+        printf("[ERROR] No job from coordinator [%s]\n", address);
+        fclose(out);
+        fclose(in);
+        return false;
+    }
+
+    Scene::Camera camera(setup.eye, setup.at, setup.up, setup.fov, (float)width / height, 0.1f, 10.0f, 1.0f);
+    camera.set_image_height(height);
+    printf("[INFO] Worker rendering scene [%s] at %dx%d for [%s]\n", scene_key.c_str(), width, height, address);
+
+    int items = 0;
+    std::vector<float> payload;
+    WorkItem item;
+    while (fgets(line, sizeof(line), in)
+        && sscanf(line, "tile %d %d %d %d %d %d %d", &item.id, &item.x, &item.y, &item.width, &item.height,
+                  &item.first_sample, &item.samples) == 7)
+    {
+        TRACE_SCOPE_ARG("work item", item.id);
+        payload.assign(item.width * item.height * 4, 0.0f);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int y = 0; y < item.height; y++)
+        for (int x = 0; x < item.width; x++)
+        {
+            int i = item.x + x, j = item.y + y;
+            float * pixel = &payload[(y * item.width + x) * 4];
+            // Streams restart every DISTRIBUTED_SAMPLES samples, so only renders of
+            // up to that many samples per pixel match a local render exactly
+            seed_pixel(seed, j * width + i, item.first_sample);
+            trace_pixel(camera, setup.world, i, j, width, height, item.samples, max_depth, true,
+                [&](const vec4 & color) {
+                    float l = luminance(color);
+                    pixel[0] += color.r;
+                    pixel[1] += color.g;
+                    pixel[2] += color.b;
+                    pixel[3] += l * l;
+                });
+        }
+        fprintf(out, "result %d\n", item.id);
+        fwrite(payload.data(), sizeof(float), payload.size(), out);
+        fflush(out);
+        if (ferror(out)) break;
+        items++;
+    }
+
+    printf("[INFO] Worker finished %d work items\n", items);
+    fclose(out);
+    fclose(in);
+    return true;
+}
+
+#else
+
+class Coordinator
+{
+public:
+    Coordinator(const std::string &, int, int, Utility::Accumulator &) {}
+
+    bool run(int)
+    {
+        printf("[ERROR] Distributed rendering needs Linux sockets\n");
+        return false;
+    }
+};
+
+bool run_worker(const char *)
+{
+    printf("[ERROR] Distributed rendering needs Linux sockets\n");
+    return false;
+}
+
+#endif
+
+#endif
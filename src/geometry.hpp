@@ -2,39 +2,65 @@
 #define __GEOMETRY_HPP__
 
 #include "global.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "arena.hpp"
+#include "memory.hpp"
 #include <memory>
 #include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RAY_PACKET_SIMD
+#endif
 
 using std::shared_ptr;
 
-namespace Material { class Material; }
+namespace Material
+{
+    class Material;
+    // Whether the material reads the uv of hit records, defined in material.hpp
+    bool uses_uv(const shared_ptr<Material> & material);
+}
 
 namespace Geometry
 {
 
+// Ray cones, an isotropic form of ray differentials, carry the width of the
+// pixel footprint along the path for texture filtering
 class Ray
 {
 private:
     vec3 m_origin;
     vec3 m_direction;
     float m_time;
+    float m_width;  // footprint width at the origin
+    float m_spread; // footprint growth per unit of distance
 
 public:
     Ray() = default;
 
-    Ray(vec3 origin, vec3 direction, float time):
+    Ray(vec3 origin, vec3 direction, float time, float width = 0.0f, float spread = 0.0f):
         m_origin(origin),
         m_direction(direction),
-        m_time(time) {}
+        m_time(time),
+        m_width(width),
+        m_spread(spread) {}
 
     vec3 origin() const { return m_origin; }
     vec3 direction() const { return m_direction; }
     float time() const { return m_time; }
+    float width() const { return m_width; }
+    float spread() const { return m_spread; }
 
     vec3 at(float t) const
     {
         return m_origin + t * m_direction;
     }
+
+    float width_at(float t) const
+    {
+        return m_width + m_spread * t * glm::length(m_direction);
+    }
 };
 
 class AABB
@@ -53,6 +79,12 @@ public:
     vec3 min() const { return m_min; }
     vec3 max() const { return m_max; }
 
+    float surface_area() const
+    {
+        vec3 d = m_max - m_min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
     bool hit(const Ray & r, double t_min, double t_max) const
     {
         for (int a = 0; a < 3; a++)
@@ -69,6 +101,29 @@ public:
         }
         return true;
     }
+
+    /**
+     * Slab test against the box linearly interpolated
+     * towards box1 with factor s in [0, 1]
+     */
+    bool hit(const Ray & r, float t_min, float t_max, const AABB & box1, float s) const
+    {
+        vec3 origin = r.origin();
+        vec3 direction = r.direction();
+        for (int a = 0; a < 3; a++)
+        {
+            float invD = 1.0f / direction[a];
+            float t0 = (m_min[a] + s * (box1.m_min[a] - m_min[a]) - origin[a]) * invD;
+            float t1 = (m_max[a] + s * (box1.m_max[a] - m_max[a]) - origin[a]) * invD;
+            if (invD < 0)
+                std::swap(t0, t1);
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max <= t_min)
+                return false;
+        }
+        return true;
+    }
 };
 
 AABB surrounding_box(AABB box0, AABB box1) {
@@ -83,6 +138,9 @@ AABB surrounding_box(AABB box0, AABB box1) {
     return AABB(min, max);
 }
 
+// Limit the footprint stretching at grazing angles
+#define FOOTPRINT_MIN_COS 0.05f
+
 struct HitRecord
 {
     vec3 point;
@@ -91,12 +149,155 @@ struct HitRecord
     float t;
     float u;
     float v;
+    float uv_scale; // change of uv per unit of distance on the surface
     bool front_face;
 
     inline void set_face_normal(const Ray & r, const vec3 & outward_normal) {
         front_face = glm::dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    /**
+     * Width of the ray footprint at the hit point in uv space
+     */
+    inline float uv_footprint(const Ray & r) const
+    {
+        float cos_theta = fabsf(glm::dot(r.direction(), normal)) / glm::length(r.direction());
+        return r.width_at(t) / MAX(cos_theta, FOOTPRINT_MIN_COS) * uv_scale;
+    }
+};
+
+// Rays per packet, a multiple of 4 up to 32
+#ifndef RAY_PACKET_SIZE
+#define RAY_PACKET_SIZE 8
+#endif
+
+/**
+ * Coherent rays traced together, such as camera rays of one pixel. Keeps the
+ * origins and inverse directions in SoA form for testing boxes against all
+ * rays at once, and their bounds for culling a box for the whole packet.
+ */
+class RayPacket
+{
+private:
+    Ray m_rays[RAY_PACKET_SIZE];
+    int m_size;
+    float m_origin[3][RAY_PACKET_SIZE];
+    float m_inv_dir[3][RAY_PACKET_SIZE];
+    vec3 m_origin_min, m_origin_max;
+    vec3 m_inv_min, m_inv_max;
+    bool m_interval[3];     // whether the inverse directions of an axis are finite and of one sign
+
+public:
+    RayPacket(): m_size(0) {}
+
+    void add(const Ray & r)
+    {
+        m_rays[m_size++] = r;
+    }
+
+    /**
+     * Fill in the SoA data and bounds, call after adding the rays
+     */
+    void prepare()
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            m_origin_min[a] = m_origin_max[a] = m_rays[0].origin()[a];
+            m_inv_min[a] = m_inv_max[a] = 1.0f / m_rays[0].direction()[a];
+            for (int i = 0; i < RAY_PACKET_SIZE; i++)
+            {
+                // Unused lanes repeat the first ray
+                const Ray & r = m_rays[i < m_size ? i : 0];
+                m_origin[a][i] = r.origin()[a];
+                m_inv_dir[a][i] = 1.0f / r.direction()[a];
+                m_origin_min[a] = MIN(m_origin_min[a], m_origin[a][i]);
+                m_origin_max[a] = MAX(m_origin_max[a], m_origin[a][i]);
+                m_inv_min[a] = MIN(m_inv_min[a], m_inv_dir[a][i]);
+                m_inv_max[a] = MAX(m_inv_max[a], m_inv_dir[a][i]);
+            }
+            m_interval[a] = fabsf(m_inv_min[a]) < FLOAT_INFINITY && fabsf(m_inv_max[a]) < FLOAT_INFINITY
+                         && (m_inv_min[a] > 0.0f || m_inv_max[a] < 0.0f);
+        }
+    }
+
+    int size() const { return m_size; }
+    unsigned int all() const { return m_size == 32 ? 0xffffffffu : (1u << m_size) - 1u; }
+    const Ray & ray(int i) const { return m_rays[i]; }
+
+    /**
+     * Interval arithmetic over the ray bounds, false when no ray of
+     * the packet can hit the box within [t_min, t_max]
+     */
+    bool may_hit(const AABB & box, float t_min, float t_max) const
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            if (!m_interval[a]) continue;
+            bool positive = m_inv_min[a] > 0.0f;
+            float near_plane = positive ? box.min()[a] : box.max()[a];
+            float far_plane = positive ? box.max()[a] : box.min()[a];
+            // Lower bound of the entry distance and upper bound of the exit distance of every ray
+            float near0 = (near_plane - m_origin_max[a]) * m_inv_min[a];
+            float near1 = (near_plane - m_origin_max[a]) * m_inv_max[a];
+            float near2 = (near_plane - m_origin_min[a]) * m_inv_min[a];
+            float near3 = (near_plane - m_origin_min[a]) * m_inv_max[a];
+            float far0 = (far_plane - m_origin_max[a]) * m_inv_min[a];
+            float far1 = (far_plane - m_origin_max[a]) * m_inv_max[a];
+            float far2 = (far_plane - m_origin_min[a]) * m_inv_min[a];
+            float far3 = (far_plane - m_origin_min[a]) * m_inv_max[a];
+            t_min = MAX(t_min, MIN(MIN(near0, near1), MIN(near2, near3)));
+            t_max = MIN(t_max, MAX(MAX(far0, far1), MAX(far2, far3)));
+        }
+        return t_min <= t_max;
+    }
+
+    /**
+     * Slab test of the active rays against a box, returns the rays hitting it
+     */
+    unsigned int hit_mask(const AABB & box, unsigned int active, float t_min, const float * t_max) const
+    {
+        unsigned int mask = 0;
+#ifdef RAY_PACKET_SIMD
+        for (int i = 0; i < RAY_PACKET_SIZE; i += 4)
+        {
+            if (!((active >> i) & 0xf)) continue;
+            __m128 near = _mm_set1_ps(t_min);
+            __m128 far = _mm_loadu_ps(t_max + i);
+            for (int a = 0; a < 3; a++)
+            {
+                __m128 origin = _mm_loadu_ps(&m_origin[a][i]);
+                __m128 inv_dir = _mm_loadu_ps(&m_inv_dir[a][i]);
+                __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.min()[a]), origin), inv_dir);
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.max()[a]), origin), inv_dir);
+                // Swap by the sign of the direction, NaN distances leave the range as is
+                __m128 negative = _mm_cmplt_ps(inv_dir, _mm_setzero_ps());
+                __m128 t_near = _mm_or_ps(_mm_and_ps(negative, t1), _mm_andnot_ps(negative, t0));
+                __m128 t_far = _mm_or_ps(_mm_and_ps(negative, t0), _mm_andnot_ps(negative, t1));
+                near = _mm_max_ps(t_near, near);
+                far = _mm_min_ps(t_far, far);
+            }
+            mask |= (unsigned int)_mm_movemask_ps(_mm_cmplt_ps(near, far)) << i;
+        }
+#else
+        for (int i = 0; i < RAY_PACKET_SIZE; i++)
+        {
+            if (!((active >> i) & 1u)) continue;
+            float near = t_min, far = t_max[i];
+            for (int a = 0; a < 3; a++)
+            {
+                float t0 = (box.min()[a] - m_origin[a][i]) * m_inv_dir[a][i];
+                float t1 = (box.max()[a] - m_origin[a][i]) * m_inv_dir[a][i];
+                if (m_inv_dir[a][i] < 0.0f)
+                    std::swap(t0, t1);
+                near = fmaxf(t0, near);
+                far = fminf(t1, far);
+            }
+            if (near < far) mask |= 1u << i;
+        }
+#endif
+        return mask & active;
+    }
 };
 
 class Hittable
@@ -104,8 +305,29 @@ class Hittable
 public:
     virtual bool hit(const Ray & r, float t_min, float t_max, HitRecord & rec) const = 0;
     virtual bool bounding_box(float time0, float time1, AABB & output_box) const = 0;
+
+    /**
+     * Closest hits of the active rays of a packet, shrinking t_max of every
+     * ray that hits. Returns the rays that hit, by default one by one.
+     */
+    virtual unsigned int hit_packet(const RayPacket & packet, unsigned int active,
+                                    float t_min, float * t_max, HitRecord * recs) const
+    {
+        unsigned int hits = 0;
+        for (int i = 0; i < packet.size(); i++)
+        {
+            if ((active >> i) & 1u && hit(packet.ray(i), t_min, t_max[i], recs[i]))
+            {
+                t_max[i] = recs[i].t;
+                hits |= 1u << i;
+            }
+        }
+        return hits;
+    }
 };
 
+inline Utility::MemoryCategory memory_category(const Hittable *) { return Utility::MEMORY_GEOMETRY; }
+
 
 void get_sphere_uv(const vec3 & p, float & u, float & v) {
     float theta = acosf(-p.y);
@@ -121,6 +343,7 @@ private:
     vec3 m_center;
     float m_radius;
     shared_ptr<Material::Material> m_material;
+    bool m_uses_uv;
 
 public:
     Sphere() = delete;
@@ -128,7 +351,8 @@ public:
     Sphere(const vec3 & center, float radius, shared_ptr<Material::Material> material):
         m_center(center),
         m_radius(radius),
-        m_material(material) {}
+        m_material(material),
+        m_uses_uv(Material::uses_uv(material)) {}
     
     virtual bool hit(const Ray & r, float t_min, float t_max, HitRecord & rec) const override;
     virtual bool bounding_box(float time0, float time1, AABB & output_box) const override;
@@ -136,6 +360,7 @@ public:
 
 bool Sphere::hit(const Ray & r, float t_min, float t_max, HitRecord & rec) const
 {
+    STATS_COUNT(primitive_tests);
     vec3 oc = r.origin() - m_center;
     float a = glm::dot(r.direction(), r.direction());
     float half_b = glm::dot(oc, r.direction());
@@ -158,7 +383,12 @@ bool Sphere::hit(const Ray & r, float t_min, float t_max, HitRecord & rec) const
     vec3 outward_normal = (rec.point - m_center) / m_radius;
     rec.set_face_normal(r, outward_normal);
     rec.material = m_material;
-    get_sphere_uv(outward_normal, rec.u, rec.v);
+    // Skip the transcendental functions for materials not reading uv
+    if (m_uses_uv)
+    {
+        get_sphere_uv(outward_normal, rec.u, rec.v);
+        rec.uv_scale = 1.0f / (PI * fabsf(m_radius));
+    }
 
     return true;
 }
@@ -236,6 +466,7 @@ private:
     float m_time0, m_time1;
     float m_radius;
     shared_ptr<Material::Material> m_material;
+    bool m_uses_uv;
 
 public:
     MovingSphere() = delete;
@@ -250,7 +481,8 @@ public:
         m_time0(time0),
         m_time1(time1),
         m_radius(radius),
-        m_material(material) {}
+        m_material(material),
+        m_uses_uv(Material::uses_uv(material)) {}
     
     vec3 center(float time) const;
     
@@ -277,6 +509,7 @@ bool MovingSphere::bounding_box(float time0, float time1, AABB & output_box) con
 
 bool MovingSphere::hit(const Ray & r, float t_min, float t_max, HitRecord & rec) const
 {
+    STATS_COUNT(primitive_tests);
     vec3 oc = r.origin() - center(r.time());
     float a = glm::dot(r.direction(), r.direction());
     float half_b = glm::dot(oc, r.direction());
@@ -299,7 +532,12 @@ bool MovingSphere::hit(const Ray & r, float t_min, float t_max, HitRecord & rec)
     vec3 outward_normal = (rec.point - center(r.time())) / m_radius;
     rec.set_face_normal(r, outward_normal);
     rec.material = m_material;
-    get_sphere_uv(outward_normal, rec.u, rec.v);
+    // Skip the transcendental functions for materials not reading uv
+    if (m_uses_uv)
+    {
+        get_sphere_uv(outward_normal, rec.u, rec.v);
+        rec.uv_scale = 1.0f / (PI * fabsf(m_radius));
+    }
 
     return true;
 }
@@ -311,6 +549,7 @@ private:
     shared_ptr<Material::Material> m_material;
     vec3 m_vn0, m_vn1, m_vn2;
     vec3 m_normal;
+    float m_uv_scale;
     AABB m_bbox;
 
 public:
@@ -333,6 +572,10 @@ public:
         m_vn1 = normal;
         m_vn2 = normal;
 
+        // Barycentric coordinates change by the inverse of the triangle heights
+        float double_area = glm::length(glm::cross(v1 - v0, v2 - v0));
+        m_uv_scale = MAX(glm::length(v2 - v1), glm::length(v0 - v2)) / double_area;
+
         vec3 min = vec3(MIN(MIN(m_v0.x, m_v1.x), m_v2.x),
                         MIN(MIN(m_v0.y, m_v1.y), m_v2.y),
                         MIN(MIN(m_v0.z, m_v1.z), m_v2.z));
@@ -366,6 +609,7 @@ public:
 
 bool Triangle::hit(const Ray & r, float t_min, float t_max, HitRecord & rec) const
 {
+    STATS_COUNT(primitive_tests);
     vec3 v01 = m_v1 - m_v0;
     vec3 v12 = m_v2 - m_v1;
     vec3 v20 = m_v0 - m_v2;
@@ -420,6 +664,7 @@ bool Triangle::hit(const Ray & r, float t_min, float t_max, HitRecord & rec) con
     // Here we use barycentric coordinates as texture uv
     rec.u /= denom;
     rec.v /= denom;
+    rec.uv_scale = m_uv_scale;
     // vec3 outward_normal = rec.u * m_vn1 + rec.v * m_vn2 + (1.0f - rec.u - rec.v) * m_vn0;
     // vec3 outward_normal = m_vn0 + m_vn1 + m_vn2;
     // outward_normal = glm::normalize(outward_normal);
@@ -440,36 +685,107 @@ bool Triangle::bounding_box(float time0, float time1, AABB & output_box) const
 
 namespace BVH {
 
+// Split the shutter interval of the root when the bounds the objects sweep over
+// it are on average this much larger than their bounds in the middle of it
+#define BVH_MOTION_SPLIT_RATIO 2.0f
+#define BVH_MAX_TIME_SEGMENTS 4
+
 class Node : public Hittable
 {
 private:
     shared_ptr<Hittable> m_left;
     shared_ptr<Hittable> m_right;
-    AABB m_box;
+    // Bounds at m_time0 and m_time1, interpolated with the ray time
+    AABB m_box0;
+    AABB m_box1;
+    float m_time0;
+    float m_time1;
+    bool m_moving;
+    // Time segment node: m_left covers [m_time0, m_split_time), m_right the rest
+    bool m_time_split;
+    float m_split_time;
+
+    void build(const std::vector<shared_ptr<Hittable> > & src_objects,
+               size_t start, size_t end, float time0, float time1);
+
+    AABB box_at(float time) const;
+
+    static float motion_ratio(const std::vector<shared_ptr<Hittable> > & objects, float time0, float time1);
 
 public:
-    Node() {};
+    Node(): m_time0(0.0f), m_time1(0.0f), m_moving(false), m_time_split(false), m_split_time(0.0f) {}
 
     Node(const HittableList & list, float time0, float time1):
-        Node(list.objects(), 0, list.objects().size(), time0, time1) {}
+        Node(list.objects(), time0, time1, BVH_MAX_TIME_SEGMENTS) {}
 
     Node(const std::vector<shared_ptr<Hittable> > & src_objects,
-         size_t start, size_t end, float time0, float time1);
+         size_t start, size_t end, float time0, float time1)
+    {
+        build(src_objects, start, end, time0, time1);
+    }
+
+    Node(const std::vector<shared_ptr<Hittable> > & objects,
+         float time0, float time1, int max_segments);
 
     virtual bool hit(const Ray & r, float t_min, float t_max, HitRecord & rec) const override;
     virtual bool bounding_box(float time0, float time1, AABB & output_box) const override;
+    virtual unsigned int hit_packet(const RayPacket & packet, unsigned int active,
+                                    float t_min, float * t_max, HitRecord * recs) const override;
+
+    float refit();
 };
 
+inline Utility::MemoryCategory memory_category(const Node *) { return Utility::MEMORY_BVH; }
+
+/**
+ * Bounds of the node at a certain time, primitives are assumed
+ * to move linearly within [m_time0, m_time1]
+ */
+AABB Node::box_at(float time) const
+{
+    float s = (time - m_time0) / (m_time1 - m_time0);
+    s = CLAMP(s, 0.0f, 1.0f);
+    return AABB(
+        m_box0.min() + s * (m_box1.min() - m_box0.min()),
+        m_box0.max() + s * (m_box1.max() - m_box0.max()));
+}
+
 bool Node::bounding_box(float time0, float time1, AABB & output_box) const
 {
-    output_box = m_box;
+    if (m_time_split)
+    {
+        AABB box_left, box_right;
+        m_left->bounding_box(time0, time1, box_left);
+        m_right->bounding_box(time0, time1, box_right);
+        output_box = surrounding_box(box_left, box_right);
+    }
+    else if (m_moving)
+    {
+        output_box = surrounding_box(box_at(time0), box_at(time1));
+    }
+    else
+    {
+        output_box = m_box0;
+    }
     return true;
 }
 
 bool Node::hit(const Ray & r, float t_min, float t_max, HitRecord& rec) const
 {
-    if (!m_box.hit(r, t_min, t_max))
+    STATS_COUNT(bvh_nodes);
+    if (m_time_split)
+        return (r.time() < m_split_time ? m_left : m_right)->hit(r, t_min, t_max, rec);
+
+    if (m_moving)
+    {
+        float s = (r.time() - m_time0) / (m_time1 - m_time0);
+        if (!m_box0.hit(r, t_min, t_max, m_box1, CLAMP(s, 0.0f, 1.0f)))
+            return false;
+    }
+    else if (!m_box0.hit(r, t_min, t_max))
+    {
         return false;
+    }
 
     bool hit_left = m_left->hit(r, t_min, t_max, rec);
     bool hit_right = m_right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
@@ -477,39 +793,172 @@ bool Node::hit(const Ray & r, float t_min, float t_max, HitRecord& rec) const
     return hit_left || hit_right;
 }
 
-inline bool box_compare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b, int axis) {
+unsigned int Node::hit_packet(const RayPacket & packet, unsigned int active,
+                              float t_min, float * t_max, HitRecord * recs) const
+{
+    // Each time segment takes the rays of its part of the interval
+    if (m_time_split)
+    {
+        unsigned int early = 0;
+        for (int i = 0; i < packet.size(); i++)
+        {
+            if (((active >> i) & 1u) && packet.ray(i).time() < m_split_time) early |= 1u << i;
+        }
+        unsigned int hits = early ? m_left->hit_packet(packet, early, t_min, t_max, recs) : 0;
+        if (active & ~early)
+            hits |= m_right->hit_packet(packet, active & ~early, t_min, t_max, recs);
+        return hits;
+    }
+
+    STATS_COUNT(bvh_nodes);
+    if (m_moving)
+    {
+        // Rays of a packet may differ in time, so each tests the box at its own
+        unsigned int mask = 0;
+        for (int i = 0; i < packet.size(); i++)
+        {
+            if (!((active >> i) & 1u)) continue;
+            const Ray & r = packet.ray(i);
+            float s = (r.time() - m_time0) / (m_time1 - m_time0);
+            if (m_box0.hit(r, t_min, t_max[i], m_box1, CLAMP(s, 0.0f, 1.0f))) mask |= 1u << i;
+        }
+        active = mask;
+    }
+    else
+    {
+        float t_far = t_min;
+        for (int i = 0; i < packet.size(); i++)
+        {
+            if ((active >> i) & 1u) t_far = MAX(t_far, t_max[i]);
+        }
+        if (!packet.may_hit(m_box0, t_min, t_far))
+            return 0;
+
+        active = packet.hit_mask(m_box0, active, t_min, t_max);
+    }
+    if (!active)
+        return 0;
+
+    unsigned int hits = m_left->hit_packet(packet, active, t_min, t_max, recs);
+    hits |= m_right->hit_packet(packet, active, t_min, t_max, recs);
+    return hits;
+}
+
+/**
+ * Surface area of the bounds each object sweeps over [time0, time1] against
+ * its bounds in the middle of the interval, averaged over the objects. 1 for
+ * a static scene, the larger the more a tree built for the whole interval
+ * loses fitting its objects at any single time.
+ */
+float Node::motion_ratio(const std::vector<shared_ptr<Hittable> > & objects, float time0, float time1)
+{
+    float ratio_sum = 0.0f;
+    int count = 0;
+    for (size_t i = 0; i < objects.size(); i++)
+    {
+        AABB swept, middle;
+        if (!objects[i]->bounding_box(time0, time1, swept)
+            || !objects[i]->bounding_box((time0 + time1) * 0.5f, (time0 + time1) * 0.5f, middle))
+            continue;
+        float middle_area = middle.surface_area();
+        if (middle_area > 0.0f)
+        {
+            ratio_sum += swept.surface_area() / middle_area;
+            count++;
+        }
+    }
+    return count > 0 ? ratio_sum / count : 1.0f;
+}
+
+/**
+ * Update the bounds of the subtree to the current bounds of its objects
+ * while keeping the tree as built, returns the summed surface area of
+ * its nodes to tell how much worse the tree got
+ */
+float Node::refit()
+{
+    float area = 0.0f;
+    const shared_ptr<Hittable> children[2] = { m_left, m_right };
+    for (int i = 0; i < (m_left == m_right ? 1 : 2); i++)
+    {
+        Node * node = dynamic_cast<Node *>(children[i].get());
+        if (node) area += node->refit();
+    }
+
+    if (m_time_split)
+    {
+        bounding_box(m_time0, m_time0, m_box0);
+        bounding_box(m_time1, m_time1, m_box1);
+        return area;
+    }
+
+    AABB left0, left1, right0, right1;
+    m_left->bounding_box (m_time0, m_time0, left0);
+    m_left->bounding_box (m_time1, m_time1, left1);
+    m_right->bounding_box(m_time0, m_time0, right0);
+    m_right->bounding_box(m_time1, m_time1, right1);
+    m_box0 = surrounding_box(left0, right0);
+    m_box1 = surrounding_box(left1, right1);
+    m_moving = m_time1 > m_time0 && !(m_box0.min() == m_box1.min() && m_box0.max() == m_box1.max());
+    return area + (m_box0.surface_area() + m_box1.surface_area()) * 0.5f;
+}
+
+inline bool box_compare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b, int axis, float time) {
     AABB box_a;
     AABB box_b;
 
-    if (!a->bounding_box(0, 0, box_a) || !b->bounding_box(0, 0, box_b))
+    if (!a->bounding_box(time, time, box_a) || !b->bounding_box(time, time, box_b))
         printf("[ERROR] No bounding box in bvh_node constructor.\n");
 
     return box_a.min()[axis] < box_b.min()[axis];
 }
 
+/**
+ * Orders objects along an axis by where they are at a certain time, the
+ * start of the interval a node is built for. The middle was tried and
+ * builds worse trees here: motion breaks up the ties of objects resting
+ * at one height, and the ties keep the order of the earlier splits.
+ */
+struct BoxCompare
+{
+    int axis;
+    float time;
 
-bool box_x_compare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b) {
-    return box_compare(a, b, 0);
-}
+    bool operator()(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b) const {
+        return box_compare(a, b, axis, time);
+    }
+};
 
-bool box_y_compare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b) {
-    return box_compare(a, b, 1);
-}
+Node::Node(
+    const std::vector<shared_ptr<Hittable> > & objects,
+    float time0, float time1, int max_segments)
+{
+    TRACE_SCOPE("bvh build");
+    if (max_segments < 2 || motion_ratio(objects, time0, time1) <= BVH_MOTION_SPLIT_RATIO)
+    {
+        build(objects, 0, objects.size(), time0, time1);
+        return;
+    }
 
-bool box_z_compare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b) {
-    return box_compare(a, b, 2);
+    // Large motion, build a tree for each half of the interval instead
+    m_split_time = (time0 + time1) * 0.5f;
+    m_left = Utility::make_scene_shared<Node>(objects, time0, m_split_time, max_segments / 2);
+    m_right = Utility::make_scene_shared<Node>(objects, m_split_time, time1, max_segments / 2);
+    m_time_split = true;
+    m_moving = false;
+    m_time0 = time0;
+    m_time1 = time1;
+    bounding_box(time0, time0, m_box0);
+    bounding_box(time1, time1, m_box1);
 }
 
-Node::Node(
+void Node::build(
     const std::vector<shared_ptr<Hittable> > & src_objects,
     size_t start, size_t end, float time0, float time1)
 {
     auto objects = src_objects; // Create a modifiable array of the source scene objects
 
-    int axis = random_int(0, 2);
-    auto comparator = (axis == 0) ? box_x_compare
-                    : (axis == 1) ? box_y_compare
-                                  : box_z_compare;
+    BoxCompare comparator = { random_int(0, 2), time0 };
 
     size_t object_span = end - start;
 
@@ -535,18 +984,25 @@ Node::Node(
         std::sort(objects.begin() + start, objects.begin() + end, comparator);
 
         auto mid = start + object_span / 2;
-        m_left = std::make_shared<Node>(objects, start, mid, time0, time1);
-        m_right = std::make_shared<Node>(objects, mid, end, time0, time1);
+        m_left = Utility::make_scene_shared<Node>(objects, start, mid, time0, time1);
+        m_right = Utility::make_scene_shared<Node>(objects, mid, end, time0, time1);
     }
 
-    AABB box_left, box_right;
+    AABB left0, left1, right0, right1;
 
-    if (  !m_left->bounding_box (time0, time1, box_left)
-       || !m_right->bounding_box(time0, time1, box_right)
+    if (  !m_left->bounding_box (time0, time0, left0)
+       || !m_left->bounding_box (time1, time1, left1)
+       || !m_right->bounding_box(time0, time0, right0)
+       || !m_right->bounding_box(time1, time1, right1)
     )
         printf("[ERROR] No bounding box in bvh_node constructor.\n");
 
-    m_box = surrounding_box(box_left, box_right);
+    m_box0 = surrounding_box(left0, right0);
+    m_box1 = surrounding_box(left1, right1);
+    m_time0 = time0;
+    m_time1 = time1;
+    m_moving = time1 > time0 && !(m_box0.min() == m_box1.min() && m_box0.max() == m_box1.max());
+    m_time_split = false;
 }
 
 } // namespace BVH
@@ -561,13 +1017,15 @@ public:
     Translate(shared_ptr<Hittable> instance, const vec3 & offset): 
         m_instance(instance), m_offset(offset) {}
 
+    void set_offset(const vec3 & offset) { m_offset = offset; }
+
     virtual bool hit(const Ray & r, float t_min, float t_max, HitRecord & rec) const override;
     virtual bool bounding_box(float time0, float time1, AABB & output_box) const override;
 };
 
 bool Translate::hit(const Ray & r, float t_min, float t_max, HitRecord & rec) const
 {
-    Ray translated(r.origin() - m_offset, r.direction(), r.time()); // subtract offset
+    Ray translated(r.origin() - m_offset, r.direction(), r.time(), r.width(), r.spread()); // subtract offset
     if (!m_instance->hit(translated, t_min, t_max, rec))
     {
         return false;
@@ -600,14 +1058,12 @@ private:
     bool m_has_bbox;
     vec3 m_center;
 
-public:
-    Rotate(shared_ptr<Hittable> instance, const vec4 & rotation):
-        m_instance(instance), m_rotation(rotation)
+    void update_bbox()
     {
         vec3 min( FLOAT_INFINITY,  FLOAT_INFINITY,  FLOAT_INFINITY);
         vec3 max(-FLOAT_INFINITY, -FLOAT_INFINITY, -FLOAT_INFINITY);
 
-        m_has_bbox = instance->bounding_box(0, 1, m_bbox);
+        m_has_bbox = m_instance->bounding_box(0, 1, m_bbox);
         if (!m_has_bbox)
             return;
         
@@ -621,7 +1077,7 @@ public:
             float y = j * m_bbox.max().y + (1 - j) * m_bbox.min().y;
             float z = k * m_bbox.max().z + (1 - k) * m_bbox.min().z;
 
-            vec3 rotated = m_center + rotate(vec3(x, y, z) - m_center, rotation);
+            vec3 rotated = m_center + rotate(vec3(x, y, z) - m_center, m_rotation);
 
             for (int c = 0; c < 3; c++)
             {
@@ -633,6 +1089,19 @@ public:
         m_bbox = AABB(min, max);
     }
 
+public:
+    Rotate(shared_ptr<Hittable> instance, const vec4 & rotation):
+        m_instance(instance), m_rotation(rotation)
+    {
+        update_bbox();
+    }
+
+    void set_rotation(const vec4 & rotation)
+    {
+        m_rotation = rotation;
+        update_bbox();
+    }
+
     virtual bool hit(const Ray & r, float t_min, float t_max, HitRecord & rec) const override;
     virtual bool bounding_box(float time0, float time1, AABB & output_box) const override;
 };
@@ -642,7 +1111,7 @@ bool Rotate::hit(const Ray & r, float t_min, float t_max, HitRecord & rec) const
     vec3 rotated_origin = m_center + rotate(r.origin() - m_center, m_rotation);
     vec3 rotated_direction = rotate(r.direction(), m_rotation);
 
-    Ray rotated(rotated_origin, rotated_direction, r.time());
+    Ray rotated(rotated_origin, rotated_direction, r.time(), r.width(), r.spread());
     if (!m_instance->hit(rotated, t_min, t_max, rec))
     {
         return false;
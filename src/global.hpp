@@ -70,16 +70,33 @@ vec4 quaternion_inverse(const vec4 & quat)
     );
 }
 
+// Rec. 709 luminance
+inline float luminance(const vec4 & color)
+{
+    return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+}
+
 inline float degree_to_radian(float degree)
 {
     return degree * PI / 180.0f;
 }
 
+// Each thread draws from its own generator
+inline std::mt19937 & random_generator()
+{
+    static thread_local std::mt19937 generator;
+    return generator;
+}
+
+inline void seed_random(unsigned int seed)
+{
+    random_generator().seed(seed);
+}
+
 inline float random_float()
 {
-    static std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
-    static std::mt19937 generator;
-    return distribution(generator);
+    static thread_local std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+    return distribution(random_generator());
 }
 
 inline float random_float(float min, float max)
@@ -102,6 +119,23 @@ inline vec3 random_vec3(float min, float max)
     return vec3(random_float(min, max), random_float(min, max), random_float(min, max));
 }
 
+// Integer hash (lowbias32), scrambles nearby inputs into unrelated seeds
+inline unsigned int hash_uint(unsigned int x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Seed this thread's generator for the samples of a pixel starting at a given index
+inline void seed_pixel(unsigned int seed, unsigned int pixel, unsigned int sample)
+{
+    seed_random(hash_uint(seed ^ hash_uint(pixel ^ hash_uint(sample))));
+}
+
 inline bool zero_vec3(const vec3 & v)
 {
     return (fabsf(v.x) < EPSILON) && (fabsf(v.y) < EPSILON) && (fabsf(v.z) < EPSILON);
@@ -134,6 +168,7 @@ vec3 random_in_unit_disk() {
 // Timer
 
 #include <string.h>
+#include <chrono>
 #define DURATION_STR_LENGTH 24
 
 // duration in seconds
@@ -148,5 +183,12 @@ void get_duration_str(float duration, char * buffer)
     sprintf(buffer, "%02d:%02d:%05.2fs", hour, minute, second);
 }
 
+// Monotonic wall clock in seconds, unlike clock() it does not add up the threads
+inline double wall_seconds()
+{
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 
 #endif
\ No newline at end of file
@@ -3,14 +3,29 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #define STB_IMAGE_IMPLEMENTATION
 #include "thirdparty/stb/stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "thirdparty/stb/stb_image_write.h"
 #include "global.hpp"
+#include "trace.hpp"
+#include "arena.hpp"
+#include "memory.hpp"
 #ifdef _OPENMP
 #include <omp.h>
 #endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PERLIN_SIMD
+#define BILATERAL_SIMD
+#endif
 
 using std::make_shared;
 using std::shared_ptr;
@@ -28,7 +43,7 @@ private:
     int m_height;
     int m_channels;
 
-    bool ends_with(const char * str, const char * suffix)
+    static bool ends_with(const char * str, const char * suffix)
     {
         if (!str || !suffix)
             return false;
@@ -39,6 +54,19 @@ private:
         return strncmp(str + lenstr - lensuffix, suffix, lensuffix) == 0;
     }
 
+    float * allocate_data(int count)
+    {
+        memory_stats().add(MEMORY_FRAMEBUFFER, count * sizeof(float));
+        return new float[count];
+    }
+
+    void free_data()
+    {
+        if (m_data) memory_stats().remove(MEMORY_FRAMEBUFFER, size() * sizeof(float));
+        delete[] m_data;
+        m_data = nullptr;
+    }
+
     stbi_uc * image_get_uchar_data()
     {
         float * f_data = (float *)malloc(size() * sizeof(float));
@@ -58,7 +86,7 @@ public:
         m_width = width;
         m_height = height;
         m_channels = channels;
-        m_data = new float[width * height * channels];
+        m_data = allocate_data(width * height * channels);
         memset(m_data, 0, width * height * channels * sizeof(float));
     }
 
@@ -67,9 +95,34 @@ public:
         load(filename);
     }
 
+    Image(const Image & other):
+        m_data(nullptr),
+        m_width(0),
+        m_height(0),
+        m_channels(0)
+    {
+        *this = other;
+    }
+
+    Image & operator = (const Image & other)
+    {
+        if (this == &other)
+            return *this;
+        if (size() != other.size())
+        {
+            free_data();
+            m_data = allocate_data(other.size());
+        }
+        m_width = other.m_width;
+        m_height = other.m_height;
+        m_channels = other.m_channels;
+        memcpy(m_data, other.m_data, size() * sizeof(float));
+        return *this;
+    }
+
     ~Image()
     {
-        delete[] m_data;
+        free_data();
     }
 
     void load(const char * filename)
@@ -87,11 +140,11 @@ public:
             exit(-1);
         }
 
+        free_data();
         m_width = width;
         m_height = height;
         m_channels = channels;
-        if (m_data) delete[] m_data;
-        m_data = new float[width * height * channels];
+        m_data = allocate_data(width * height * channels);
         memcpy(m_data, data, width * height * channels * sizeof(float));
 
         stbi_image_free(data);
@@ -100,8 +153,18 @@ public:
     /**
      * Save image
      */
+    /**
+     * Whether save() writes files of this name's extension
+     */
+    static bool can_save(const char * filename)
+    {
+        return ends_with(filename, ".jpg") || ends_with(filename, ".bmp") || ends_with(filename, ".hdr")
+            || ends_with(filename, ".png") || ends_with(filename, ".tga");
+    }
+
     void save(const char * filename)
     {
+        TRACE_SCOPE("image save");
         if (ends_with(filename, ".jpg"))
         {
             stbi_uc * data = image_get_uchar_data();
@@ -143,6 +206,19 @@ public:
         return m_data[pos];
     }
 
+    /**
+     * Copy another image with the same channels into this one,
+     * its lower left corner placed at (x0, y0)
+     */
+    void paste(const Image & image, int x0, int y0)
+    {
+        for (int y = 0; y < image.height(); y++)
+        {
+            memcpy(&(*this)(x0, y0 + y, 0), &image.m_data[(image.m_height - 1 - y) * image.m_width * m_channels],
+                image.m_width * m_channels * sizeof(float));
+        }
+    }
+
     /**
      * Access to image data at certain integer position
      * (Deprecate)
@@ -212,6 +288,377 @@ public:
     float * data() const { return m_data; }
 };
 
+/**
+ * Decoding table from 8-bit to linear values, same gamma
+ * as stbi_loadf uses for 8-bit image files
+ */
+struct GammaTable
+{
+    float values[256];
+
+    GammaTable()
+    {
+        for (int i = 0; i < 256; i++)
+            values[i] = powf(i / 255.0f, 2.2f);
+    }
+};
+
+inline const float * gamma_table()
+{
+    static const GammaTable table;
+    return table.values;
+}
+
+inline stbi_uc encode_gamma(float value)
+{
+    return static_cast<stbi_uc>(powf(CLAMP(value, 0.0f, 1.0f), 1.0f / 2.2f) * 255.0f + 0.5f);
+}
+
+// Texel orders in memory: rows of the whole image, or square tiles so that
+// the four taps of a bilinear lookup mostly fall in the same cache lines
+enum ImageLayout {
+    LAYOUT_LINEAR, LAYOUT_TILED,
+};
+
+#define IMAGE_TILE_SHIFT 3
+#define IMAGE_TILE_SIZE (1 << IMAGE_TILE_SHIFT)
+
+/**
+ * Read only image in the native 8-bit form of texture files, always
+ * stored as RGBA and decoded to linear float when sampled
+ */
+class CompactImage
+{
+private:
+    std::vector<stbi_uc, CountedAllocator<stbi_uc, MEMORY_TEXTURES> > m_data;
+    int m_width;
+    int m_height;
+    ImageLayout m_layout;
+    int m_tiles_x;
+
+    void allocate()
+    {
+        m_tiles_x = (m_width + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE;
+        int tiles_y = (m_height + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE;
+        if (m_layout == LAYOUT_TILED)
+            m_data.assign(m_tiles_x * tiles_y * IMAGE_TILE_SIZE * IMAGE_TILE_SIZE * 4, 255);
+        else
+            m_data.assign(m_width * m_height * 4, 255);
+    }
+
+    int offset(int x, int y) const
+    {
+        y = m_height - 1 - y;
+        if (m_layout == LAYOUT_LINEAR)
+            return (x + y * m_width) * 4;
+
+        int tile = (y >> IMAGE_TILE_SHIFT) * m_tiles_x + (x >> IMAGE_TILE_SHIFT);
+        int texel = ((y & (IMAGE_TILE_SIZE - 1)) << IMAGE_TILE_SHIFT) + (x & (IMAGE_TILE_SIZE - 1));
+        return ((tile << (2 * IMAGE_TILE_SHIFT)) + texel) * 4;
+    }
+
+public:
+    CompactImage() = delete;
+
+    CompactImage(int width, int height, ImageLayout layout = LAYOUT_LINEAR):
+        m_width(width),
+        m_height(height),
+        m_layout(layout)
+    {
+        allocate();
+    }
+
+    CompactImage(const char * filename, ImageLayout layout = LAYOUT_LINEAR):
+        m_layout(layout)
+    {
+        TRACE_SCOPE("texture load");
+        int width, height, channels;
+        if (stbi_is_hdr(filename))
+        {
+            printf("[WARNING] Clamping HDR texture [%s] to 8-bit\n", filename);
+        }
+        stbi_uc * data = stbi_load(filename, &width, &height, &channels, 4);
+        if (!data)
+        {
+            printf("[ERROR] Failed to load [%s]\n", filename);
+            exit(-1);
+        }
+
+        m_width = width;
+        m_height = height;
+        allocate();
+        for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+        {
+            memcpy(&m_data[offset(x, height - 1 - y)], data + (x + y * width) * 4, 4);
+        }
+
+        stbi_image_free(data);
+    }
+
+    /**
+     * Linear color at certain integer position
+     */
+    vec4 pixel_at(int x, int y) const
+    {
+        const float * table = gamma_table();
+        const stbi_uc * texel = &m_data[offset(x, y)];
+        return vec4(
+            table[texel[0]],
+            table[texel[1]],
+            table[texel[2]],
+            texel[3] * (1.0f / 255.0f) );
+    }
+
+    void set_pixel(int x, int y, const vec4 & color)
+    {
+        stbi_uc * texel = &m_data[offset(x, y)];
+        texel[0] = encode_gamma(color.r);
+        texel[1] = encode_gamma(color.g);
+        texel[2] = encode_gamma(color.b);
+        texel[3] = static_cast<stbi_uc>(CLAMP(color.a, 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+
+    /**
+     * Sample a rgba color with a float uv coords
+     * using bilinear interpolation
+     */
+    vec4 sample(const vec2 & uv) const
+    {
+        float fx = CLAMP(uv.x, 0.0f, 1.0f) * m_width - 0.5f;
+        float fy = CLAMP(uv.y, 0.0f, 1.0f) * m_height - 0.5f;
+        int x0 = static_cast<int>(floor(fx));
+        int y0 = static_cast<int>(floor(fy));
+        float alpha_x = fx - (float)x0;
+        float alpha_y = fy - (float)y0;
+
+        int x1 = x0 + 1;
+        int y1 = y0 + 1;
+
+        if (x0 < 0) x0 = 0;
+        if (y0 < 0) y0 = 0;
+        if (x0 == m_width - 1) x1 = x0;
+        if (y0 == m_height - 1) y1 = y0;
+
+        return  LERP( LERP(pixel_at(x0, y0), pixel_at(x1, y0), alpha_x),
+                      LERP(pixel_at(x0, y1), pixel_at(x1, y1), alpha_x),
+                      alpha_y );
+    }
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    ImageLayout layout() const { return m_layout; }
+    size_t bytes() const { return m_data.size(); }
+};
+
+inline MemoryCategory memory_category(const CompactImage *) { return MEMORY_TEXTURES; }
+
+/**
+ * Image pyramid built at load time, each level is box filtered
+ * to half the size of the previous one down to 1x1
+ */
+class MipMap
+{
+private:
+    std::vector<shared_ptr<CompactImage> > m_levels;
+
+    static shared_ptr<CompactImage> downsample(const CompactImage & image)
+    {
+        int width = MAX(image.width() / 2, 1);
+        int height = MAX(image.height() / 2, 1);
+        auto level = make_scene_shared<CompactImage>(width, height, image.layout());
+
+        for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+        {
+            int x0 = MIN(x * 2, image.width() - 1);
+            int y0 = MIN(y * 2, image.height() - 1);
+            int x1 = MIN(x * 2 + 1, image.width() - 1);
+            int y1 = MIN(y * 2 + 1, image.height() - 1);
+            // Filter in linear space
+            level->set_pixel(x, y, 0.25f * ( image.pixel_at(x0, y0) + image.pixel_at(x1, y0)
+                                           + image.pixel_at(x0, y1) + image.pixel_at(x1, y1) ));
+        }
+
+        return level;
+    }
+
+public:
+    MipMap() = delete;
+
+    MipMap(const char * filename, ImageLayout layout = LAYOUT_LINEAR)
+    {
+        m_levels.push_back(make_scene_shared<CompactImage>(filename, layout));
+        while (m_levels.back()->width() > 1 || m_levels.back()->height() > 1)
+        {
+            m_levels.push_back(downsample(*m_levels.back()));
+        }
+    }
+
+    int levels() const { return static_cast<int>(m_levels.size()); }
+    const CompactImage & level(int i) const { return *m_levels[i]; }
+
+    /**
+     * Trilinear lookup between the two levels whose
+     * texel size is closest to the footprint in uv space
+     */
+    vec4 sample(const vec2 & uv, float footprint) const
+    {
+        float texels = footprint * MAX(m_levels[0]->width(), m_levels[0]->height());
+        if (texels <= 1.0f)
+            return m_levels[0]->sample(uv);
+
+        float lod = MIN(log2f(texels), (float)(levels() - 1));
+        int l0 = static_cast<int>(lod);
+        float alpha = lod - (float)l0;
+        if (l0 == levels() - 1)
+            return m_levels[l0]->sample(uv);
+
+        return LERP(m_levels[l0]->sample(uv), m_levels[l0 + 1]->sample(uv), alpha);
+    }
+};
+
+#ifdef _WIN32
+#define FSEEK64 _fseeki64
+#else
+#define FSEEK64 fseeko
+#endif
+
+/**
+ * Writes tiles of a float RGB image straight to their place in a PFM file,
+ * so that the full image never has to be in memory. Regions never written
+ * read as black.
+ */
+class PFMTileWriter
+{
+private:
+    FILE * m_file;
+    int m_width;
+    int m_height;
+    long long m_header_size;
+
+public:
+    PFMTileWriter(const char * filename, int width, int height):
+        m_width(width),
+        m_height(height)
+    {
+        m_file = fopen(filename, "wb");
+        if (!m_file)
+        {
+            printf("[ERROR] Failed to open [%s]\n", filename);
+            exit(-1);
+        }
+
+        // Negative scale for little endian floats, rows go from bottom to top
+        m_header_size = fprintf(m_file, "PF\n%d %d\n-1.0\n", width, height);
+
+        // Allocate the whole file up front
+        long long size = m_header_size + (long long)width * height * 3 * sizeof(float);
+        FSEEK64(m_file, size - 1, SEEK_SET);
+        fputc(0, m_file);
+    }
+
+    ~PFMTileWriter()
+    {
+        fclose(m_file);
+    }
+
+    /**
+     * Write a 3 channel tile with its lower left corner at (x0, y0)
+     */
+    void write_tile(const Image & tile, int x0, int y0)
+    {
+        for (int y = 0; y < tile.height(); y++)
+        {
+            long long offset = m_header_size + ((long long)(y0 + y) * m_width + x0) * 3 * sizeof(float);
+            FSEEK64(m_file, offset, SEEK_SET);
+            fwrite(tile.data() + (tile.height() - 1 - y) * tile.width() * 3, sizeof(float), tile.width() * 3, m_file);
+        }
+        fflush(m_file);
+    }
+};
+
+/**
+ * Saves snapshots of an image on a background thread, a snapshot submitted
+ * while the writer is busy replaces the one still waiting to be saved
+ */
+class AsyncImageWriter
+{
+private:
+    std::string m_filename;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    shared_ptr<Image> m_pending;
+    bool m_finished;
+    int m_dropped;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_condition.wait(lock, [this] { return m_pending || m_finished; });
+            if (!m_pending)
+                break;
+
+            shared_ptr<Image> snapshot = m_pending;
+            m_pending.reset();
+            lock.unlock();
+            snapshot->save(m_filename.c_str());
+            lock.lock();
+        }
+    }
+
+public:
+    AsyncImageWriter(const char * filename):
+        m_filename(filename),
+        m_finished(false),
+        m_dropped(0)
+    {
+        m_thread = std::thread(&AsyncImageWriter::run, this);
+    }
+
+    ~AsyncImageWriter()
+    {
+        finish();
+    }
+
+    /**
+     * Copy the image for saving, the render goes on while it is encoded
+     */
+    void submit(const Image & image)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_pending)
+        {
+            *m_pending = image;
+            m_dropped++;
+        }
+        else
+        {
+            m_pending = make_shared<Image>(image);
+        }
+        m_condition.notify_one();
+    }
+
+    /**
+     * Save the last submitted snapshot and stop the writer thread
+     */
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finished = true;
+            m_condition.notify_one();
+        }
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+    int dropped() const { return m_dropped; }
+};
+
 float gaussian(float value, float sigma)
 {
     return expf(-fabs(value) / (2.0f * sigma * sigma));
@@ -220,22 +667,23 @@ float gaussian(float value, float sigma)
 std::vector<float> generate_gaussian_kernel(int size, float sigma)
 {
     int half_size = abs(size) / 2;
-    int k_index = 0;
     std::vector<float> kernel;
     kernel.reserve(size * size);
 
-    for (int x = -half_size; x <= half_size; x++)
+    for (int y = -half_size; y <= half_size; y++)
     {
-        for (int y = -half_size; y <= half_size; y++)
+        for (int x = -half_size; x <= half_size; x++)
         {
-            kernel[k_index] = gaussian(x * x + y * y, sigma);
-            k_index++;
+            kernel.push_back(gaussian(x * x + y * y, sigma));
         }
     }
 
     return kernel;
 }
 
+// Range weights are looked up at this many steps up to where gaussian() falls to about 1e-7
+#define BILATERAL_LUT_SIZE 4096
+
 Image bilateral_filtering(const Image & image, int kernel_size, float sigma_r, float sigma_s)
 {
     assert(kernel_size % 2 == 1);
@@ -243,50 +691,149 @@ Image bilateral_filtering(const Image & image, int kernel_size, float sigma_r, f
     auto space_kernel = generate_gaussian_kernel(kernel_size, sigma_s);
 
     int half_size = kernel_size / 2;
-    clock_t start_timestamp = clock();
-    Image result(image.width(), image.height(), image.channels());
+    double start_timestamp = wall_seconds();
+    int width = image.width();
+    int height = image.height();
+    int channels = image.channels();
+    Image result(width, height, channels);
+
+    // gaussian(d, sigma_r) for |d| at the table steps, 0 past the end
+    float range_max = 16.0f * 2.0f * sigma_r * sigma_r;
+    float range_scale = BILATERAL_LUT_SIZE / range_max;
+    std::vector<float> range_lut(BILATERAL_LUT_SIZE + 1);
+    for (int i = 0; i < BILATERAL_LUT_SIZE; i++)
+    {
+        range_lut[i] = gaussian(i / range_scale, sigma_r);
+    }
+    range_lut[BILATERAL_LUT_SIZE] = 0.0f;
+
+    // Copy with edge pixels repeated half a kernel out, so the taps need no clamping
+    int padded_width = width + 2 * half_size;
+    int row_stride = padded_width * channels;
+    std::vector<float> padded(row_stride * (height + 2 * half_size));
+    for (int y = 0; y < height + 2 * half_size; y++)
+    for (int x = 0; x < padded_width; x++)
+    {
+        int s_x = CLAMP(x - half_size, 0, width - 1);
+        int s_y = CLAMP(y - half_size, 0, height - 1);
+        for (int c = 0; c < channels; c++)
+        {
+            padded[y * row_stride + x * channels + c] = image.pixel_at(s_x, s_y, c);
+        }
+    }
+
+    // Row-major over the output, taps read neighbouring rows of the padded copy
+    int row_size = width * channels;
+    std::vector<int> tap_offsets;
+    for (int k_y = 0; k_y < kernel_size; k_y++)
+    for (int k_x = 0; k_x < kernel_size; k_x++)
+    {
+        tap_offsets.push_back((k_y - half_size) * row_stride + (k_x - half_size) * channels);
+    }
+    int taps = (int)tap_offsets.size();
 
 #ifdef _OPENMP
 #pragma omp parallel for
 #endif
-    for (int x = 0; x < image.width(); x++)
-    for (int y = 0; y < image.height(); y++)
+    for (int y = 0; y < height; y++)
     {
-        for (int c = 0; c < image.channels(); c++)
+        const float * center = &padded[(y + half_size) * row_stride + half_size * channels];
+        float * out = &result(0, y, 0);
+        int e = 0;
+#ifdef BILATERAL_SIMD
+        // Four channel values at a time, only the table lookups are scalar
+        const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        const __m128 scale = _mm_set1_ps(range_scale);
+        const __m128 last_step = _mm_set1_ps((float)BILATERAL_LUT_SIZE);
+        const __m128 half = _mm_set1_ps(0.5f);
+        for (; e + 4 <= row_size; e += 4)
+        {
+            __m128 c = _mm_loadu_ps(center + e);
+            __m128 weight = _mm_setzero_ps();
+            __m128 value = _mm_setzero_ps();
+            for (int k = 0; k < taps; k++)
+            {
+                __m128 t = _mm_loadu_ps(center + e + tap_offsets[k]);
+                __m128 distance = _mm_mul_ps(_mm_and_ps(_mm_sub_ps(t, c), abs_mask), scale);
+                distance = _mm_min_ps(_mm_add_ps(distance, half), last_step);
+                alignas(16) int step[4];
+                _mm_store_si128((__m128i *)step, _mm_cvttps_epi32(distance));
+                __m128 factor = _mm_mul_ps(_mm_set1_ps(space_kernel[k]),
+                    _mm_setr_ps(range_lut[step[0]], range_lut[step[1]], range_lut[step[2]], range_lut[step[3]]));
+                weight = _mm_add_ps(weight, factor);
+                value = _mm_add_ps(value, _mm_mul_ps(factor, t));
+            }
+            _mm_storeu_ps(out + e, _mm_div_ps(value, weight));
+        }
+#endif
+        for (; e < row_size; e++)
         {
             float weight = 0.0f;
             float value = 0.0f;
-            float factor = 0.0f;
-            int k_index = 0;
-            for (int k_x = x - half_size; k_x <= x + half_size; k_x++)
-            for (int k_y = y - half_size; k_y <= y + half_size; k_y++)
+            for (int k = 0; k < taps; k++)
             {
-                int s_x = CLAMP(k_x, 0, image.width() - 1);
-                int s_y = CLAMP(k_y, 0, image.height() - 1);
-                factor = gaussian(image.pixel_at(s_x, s_y, c) - image.pixel_at(x, y, c), sigma_r)
-                       * space_kernel[k_index];
-                k_index++;
+                float t = center[e + tap_offsets[k]];
+                float distance = fabsf(t - center[e]) * range_scale + 0.5f;
+                float factor = space_kernel[k] * range_lut[(int)MIN(distance, (float)BILATERAL_LUT_SIZE)];
                 weight += factor;
-                value += factor * image.pixel_at(s_x, s_y, c);
+                value += factor * t;
             }
-            result(x, y, c) = value / weight;
+            out[e] = value / weight;
         }
     }
 
     char total_time[DURATION_STR_LENGTH];
-    float duration = ((float)(clock() - start_timestamp) / CLOCKS_PER_SEC);
+    float duration = (float)(wall_seconds() - start_timestamp);
     get_duration_str(duration, total_time);
     printf("[INFO] Bilateral filtering time: %s\n", total_time);
 
     return result;
 }
 
+/**
+ * Map a single channel image to a blue - cyan - green - yellow - red ramp,
+ * from 0 to the 99th percentile so a few outliers don't flatten the rest
+ */
+Image false_color(const Image & values, float & max_value)
+{
+    static const vec3 ramp[5] = {
+        vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 1.0f, 1.0f), vec3(0.0f, 1.0f, 0.0f),
+        vec3(1.0f, 1.0f, 0.0f), vec3(1.0f, 0.0f, 0.0f)
+    };
+
+    std::vector<float> sorted(values.data(), values.data() + values.size());
+    size_t k = sorted.size() * 99 / 100;
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    max_value = sorted.empty() ? 0.0f : sorted[k];
+
+    Image result(values.width(), values.height(), 3);
+    for (int y = 0; y < values.height(); y++)
+    for (int x = 0; x < values.width(); x++)
+    {
+        float s = max_value > 0.0f ? CLAMP(values.pixel_at(x, y, 0) / max_value, 0.0f, 1.0f) * 4.0f : 0.0f;
+        int i = MIN((int)s, 3);
+        vec3 color = LERP(ramp[i], ramp[i + 1], (s - i));
+        // Undo the gamma applied on save
+        for (int c = 0; c < 3; c++) result(x, y, c) = powf(color[c], 2.2f);
+    }
+    return result;
+}
+
 class Texture
 {
 public:
-    virtual vec4 value(float u, float v, const vec3 & p) const = 0;
+    /**
+     * Texture value at a hit point, footprint is the width of
+     * the lookup in uv space for filtering, 0 for a point sample
+     */
+    virtual vec4 value(float u, float v, const vec3 & p, float footprint) const = 0;
+
+    // Whether value() reads u and v, or only the point p
+    virtual bool uses_uv() const { return true; }
 };
 
+inline MemoryCategory memory_category(const Texture *) { return MEMORY_TEXTURES; }
+
 class SolidColor : public Texture
 {
 private:
@@ -300,10 +847,12 @@ public:
     SolidColor(float r, float g, float b):
         SolidColor(vec4(r, g, b, 1.0f)) {}
 
-    virtual vec4 value(float u, float v, const vec3 & p) const override
+    virtual vec4 value(float u, float v, const vec3 & p, float footprint) const override
     {
         return m_color;
     }
+
+    virtual bool uses_uv() const override { return false; }
 };
 
 class CheckerTexture : public Texture
@@ -320,18 +869,18 @@ public:
         m_even(even), m_odd(odd), m_num(num) {}
 
     CheckerTexture(vec4 color0, vec4 color1, int num = 10): 
-        m_even(make_shared<SolidColor>(color0)), 
-        m_odd(make_shared<SolidColor>(color1)),
+        m_even(make_scene_shared<SolidColor>(color0)), 
+        m_odd(make_scene_shared<SolidColor>(color1)),
         m_num(num) {}
 
-    virtual vec4 value(float u, float v, const vec3 & p) const override
+    virtual vec4 value(float u, float v, const vec3 & p, float footprint) const override
     {
         int x = u * m_num;
         int y = v * m_num;
         if ((x % 2 + y % 2) % 2 == 1)
-            return m_odd->value(u, v, p);
+            return m_odd->value(u, v, p, footprint);
         else
-            return m_even->value(u, v, p);
+            return m_even->value(u, v, p, footprint);
         // float sines = sinf(10.0f * p.x) * sinf(10.0f * p.y) * sinf(10.0f * p.z);
         // if (sines < 0)
         //     return m_odd->value(u, v, p);
@@ -434,6 +983,93 @@ public:
         return trilinear_interp(c, u, v, w);
     }
 
+#ifdef PERLIN_SIMD
+    /**
+     * noise() at 4 points in one pass, only the
+     * gradient lookups are done per point
+     */
+    void noise4(const float * x, const float * y, const float * z, float * result) const
+    {
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 p[3] = { _mm_loadu_ps(x), _mm_loadu_ps(y), _mm_loadu_ps(z) };
+        __m128 frac[3];
+        __m128 weights[3][2];
+        int cells[3][4];
+
+        for (int a = 0; a < 3; a++)
+        {
+            // floor without SSE4.1
+            __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(p[a]));
+            __m128 floored = _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, p[a]), one));
+            _mm_storeu_si128((__m128i *)cells[a], _mm_cvttps_epi32(floored));
+
+            frac[a] = _mm_sub_ps(p[a], floored);
+            __m128 hermite = _mm_mul_ps(_mm_mul_ps(frac[a], frac[a]),
+                _mm_sub_ps(_mm_set1_ps(3.0f), _mm_add_ps(frac[a], frac[a])));
+            // Same corner weights as trilinear_interp
+            weights[a][0] = _mm_sub_ps(one, frac[a]);
+            weights[a][1] = hermite;
+        }
+
+        __m128 accum = _mm_setzero_ps();
+        for (int di = 0; di < 2; di++)
+        for (int dj = 0; dj < 2; dj++)
+        for (int dk = 0; dk < 2; dk++)
+        {
+            float gx[4], gy[4], gz[4];
+            for (int l = 0; l < 4; l++)
+            {
+                const vec3 & gradient = m_vecs[
+                    m_perm_x[(cells[0][l] + di) & 255] ^
+                    m_perm_y[(cells[1][l] + dj) & 255] ^
+                    m_perm_z[(cells[2][l] + dk) & 255]
+                ];
+                gx[l] = gradient.x;
+                gy[l] = gradient.y;
+                gz[l] = gradient.z;
+            }
+
+            __m128 dot = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(_mm_loadu_ps(gx), _mm_sub_ps(frac[0], _mm_set1_ps((float)di))),
+                _mm_mul_ps(_mm_loadu_ps(gy), _mm_sub_ps(frac[1], _mm_set1_ps((float)dj)))),
+                _mm_mul_ps(_mm_loadu_ps(gz), _mm_sub_ps(frac[2], _mm_set1_ps((float)dk))));
+            __m128 weight = _mm_mul_ps(_mm_mul_ps(weights[0][di], weights[1][dj]), weights[2][dk]);
+            accum = _mm_add_ps(accum, _mm_mul_ps(weight, dot));
+        }
+
+        _mm_storeu_ps(result, accum);
+    }
+
+    /**
+     * Evaluate 4 octaves per noise4() pass
+     */
+    float turb(const vec3 & p, int depth = 7) const
+    {
+        float accum  = 0.0f;
+        float scale  = 1.0f;
+        float weight = 1.0f;
+
+        for (int octave = 0; octave < depth; octave += 4)
+        {
+            float x[4], y[4], z[4], weights[4], noises[4];
+            for (int l = 0; l < 4; l++)
+            {
+                x[l] = p.x * scale;
+                y[l] = p.y * scale;
+                z[l] = p.z * scale;
+                weights[l] = octave + l < depth ? weight : 0.0f;
+                weight *= 0.5f;
+                scale *= 2.0f;
+            }
+
+            noise4(x, y, z, noises);
+            accum += weights[0] * noises[0] + weights[1] * noises[1]
+                   + weights[2] * noises[2] + weights[3] * noises[3];
+        }
+
+        return fabsf(accum);
+    }
+#else
     float turb(const vec3 & p, int depth = 7) const
     {
         float accum  = 0.0f;
@@ -449,6 +1085,7 @@ public:
 
         return fabsf(accum);
     }
+#endif
 };
 
 class NoiseTexturePos : public Texture
@@ -463,28 +1100,30 @@ public:
     NoiseTexturePos(float scale):
         m_scale(scale) {}
 
-    virtual vec4 value(float u, float v, const vec3 & p) const override
+    virtual vec4 value(float u, float v, const vec3 & p, float footprint) const override
     {
         // return COLOR_WHITE * 0.5f * (1.0f + m_noise.noise(m_scale * p));
         // return COLOR_WHITE * m_noise.turb(m_scale * p);
         return COLOR_WHITE * 0.5f * (1.0f + sinf(m_scale * p.z + 10.0f * m_noise.turb(m_scale * p)));
     }
+
+    virtual bool uses_uv() const override { return false; }
 };
 
 class ImageTexture : public Texture
 {
 private:
-    Image m_image;
+    MipMap m_mipmap;
 
 public:
     ImageTexture() = delete;
 
-    ImageTexture(const char * filename):
-        m_image(Image(filename)) {}
+    ImageTexture(const char * filename, ImageLayout layout = LAYOUT_LINEAR):
+        m_mipmap(filename, layout) {}
     
-    virtual vec4 value(float u, float v, const vec3 & p) const override
+    virtual vec4 value(float u, float v, const vec3 & p, float footprint) const override
     {
-        return m_image.sample(vec2(u, v));
+        return m_mipmap.sample(vec2(u, v), footprint);
     }
 };
 
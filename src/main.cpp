@@ -1,26 +1,39 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <memory>
 #include <time.h>
 #include <vector>
 #include <utility>
+#include <atomic>
+#include <algorithm>
 #include "global.hpp"
 #include "image.hpp"
 #include "geometry.hpp"
 #include "camera.hpp"
 #include "material.hpp"
 #include "scene.hpp"
+#include "scene_file.hpp"
+#include "checkpoint.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "render.hpp"
+#include "denoise.hpp"
+#include "server.hpp"
+#include "distributed.hpp"
+#include "sequence.hpp"
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
+// Camera rays per pixel for the denoiser guides, enough to antialias edges
+#define DENOISE_GUIDE_SAMPLES 8
+
 #define WRITE_COLOR(image,x,y,color) do { image(x, y, 0) = color.r;  \
                                           image(x, y, 1) = color.g;  \
                                           image(x, y, 2) = color.b; } while(0)
 
-vec4 ray_color(const Geometry::Ray & r, const Geometry::Hittable & world, int depth);
-
-int main()
+int main(int argc, char * argv[])
 {
     // --- Configuration ---
     // modify as needed
@@ -30,7 +43,35 @@ int main()
     int samples_per_pixel = 500;        // samples per pixel
     int max_depth = 50;                 // max ray tracing depth
     bool bilinear_filter = false;       // perform bilinear filter to result
+    bool denoise = false;               // denoise result with an edge-avoiding A-Trous filter guided by
+                                        // first hit albedo, normal and depth, for low spp renders
     int tile = 8;                       // tiles num
+    bool packet_tracing = true;         // trace camera rays of a pixel through the BVH in packets
+    const char * stream_output = nullptr; // e.g. "result.pfm", write finished tiles straight to
+                                        // a PFM file instead of keeping the frame in memory
+    const char * checkpoint_file = nullptr; // e.g. "result.ckpt", periodically save per-pixel
+                                        // sample sums so an interrupted render can be resumed
+    int checkpoint_interval = 300;      // seconds between checkpoints
+    bool resume = false;                // continue from checkpoint_file, a larger samples_per_pixel
+                                        // adds samples to a finished render
+    bool progressive = false;           // render whole-image passes of 1, 2, 4... spp until samples_per_pixel,
+                                        // the time budget or the noise target is reached
+    float time_budget = 0.0f;           // progressive wall-clock budget in seconds, 0 for none
+    float noise_target = 0.0f;          // progressive target of mean pixel standard error relative to
+                                        // mean luminance (e.g. 0.01), 0 for none
+    const char * heatmap_prefix = nullptr; // e.g. "heatmap", save false colour maps of per-pixel cost
+                                        // (BVH nodes, primitive tests, path length, time)
+    const char * trace_file = nullptr;  // e.g. "trace.json", timeline of tiles, passes, loading and
+                                        // saving in Chrome trace format, open it in Perfetto
+    const char * scene_file = nullptr;  // e.g. "assets/scene/cornell_box.scene", render a scene description
+                                        // file instead of a built-in scene, see scene_file.hpp for the format
+    bool sequence = false;              // render the key frames of scene_file to frame_0000.png, frame_0001.png...
+                                        // instead of result.png
+    const char * server = nullptr;      // "-" to take render jobs on stdin or a UNIX socket path, keeping
+                                        // scenes loaded between jobs instead of rendering once, see server.hpp
+    int coordinator_port = 0;           // e.g. 7878, hand out tiles of this render to workers connecting
+                                        // over TCP instead of rendering locally, 0 for none
+    const char * worker = nullptr;      // e.g. "localhost:7878", render tiles for a coordinator and exit
     int scene_idx = 5;                  // which scene to render
     // 0 - random spheres as in 'Ray Tracing in One Weekend'
     // 1 - simpler scene with 3 spheres and 3 emissive triangles as in Ray Tracing in One Weekend
@@ -40,136 +81,369 @@ int main()
     // 5 - cornell box with rotated boxes (will change aspect_ratio to 1)
     // 6 - cornell box with mesh inside (will change aspect_ratio to 1)
 
-    // World
-    Geometry::BVH::Node world;
-    vec3 eye, at, up;
-    float fov;
-
-    switch (scene_idx)
-    {
-        case 0:
-            world = generate_random_scene();
-            eye = vec3(13.0f, 2.0f, 3.0f);
-            at  = vec3( 0.0f, 0.0f, 0.0f);
-            up  = vec3( 0.0f, 1.0f, 0.0f);
-            fov = 20.0f;
-            break;
-        case 1:
-            world = generate_simple_scene();
-            eye = vec3( 0.0f, 4.0f, 6.0f);
-            at  = vec3( 0.0f, 0.0f, 0.0f);
-            up  = vec3( 0.0f, 1.0f, 0.0f);
-            fov = 90.0f;
-            break;
-        case 2:
-            world = generate_two_perlin_spheres();
-            eye = vec3(13.0f, 2.0f, 3.0f);
-            at  = vec3( 0.0f, 0.0f, 0.0f);
-            up  = vec3( 0.0f, 1.0f, 0.0f);
-            fov = 20.0;
-            break;
-        case 3:
-            world = generate_earth();
-            eye = vec3(13.0f, 2.0f, 3.0f);
-            at  = vec3( 0.0f, 0.0f, 0.0f);
-            up  = vec3( 0.0f, 1.0f, 0.0f);
-            fov = 20.0;
-            break;
-        case 4:
-            world = generate_cornell_box();
-            eye = vec3(278.0f, 278.0f, -750.0f);
-            at  = vec3(278.0f, 278.0f,    0.0f);
-            up  = vec3(  0.0f,  1.0f,     0.0f);
-            fov = 40.0;
-            aspect_ratio = 1.0f;
-            break;
-        case 5:
-            world = generate_cornell_box_transformed();
-            eye = vec3(278.0f, 278.0f, -750.0f);
-            at  = vec3(278.0f, 278.0f,    0.0f);
-            up  = vec3(  0.0f,  1.0f,     0.0f);
-            fov = 40.0;
-            aspect_ratio = 1.0f;
-            break;
-        case 6:
-            world = generate_cornell_box_mesh();
-            eye = vec3(278.0f, 278.0f, -750.0f);
-            at  = vec3(278.0f, 278.0f,    0.0f);
-            up  = vec3(  0.0f,  1.0f,     0.0f);
-            fov = 40.0;
-            aspect_ratio = 1.0f;
-            break;
+    // The same build runs on every machine of a distributed render, the
+    // command line picks its role
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = i + 1 < argc;
+        if (has_value && strcmp(argv[i], "--worker") == 0) worker = argv[++i];
+        else if (has_value && strcmp(argv[i], "--coordinator") == 0) coordinator_port = atoi(argv[++i]);
+        else
+        {
+            printf("[ERROR] Unknown argument [%s]\n", argv[i]);
+            exit(-1);
+        }
+    }
+
+    if (trace_file)
+    {
+        Utility::tracer().enable();
+    }
+
+    if (server)
+    {
+        RenderServer render_server;
+        bool served = true;
+        if (strcmp(server, "-") == 0) render_server.serve(stdin, stdout);
+        else served = render_server.serve_socket(server);
+        if (trace_file && Utility::tracer().write_json(trace_file))
+        {
+            printf("[INFO] Trace saved to [%s]\n", trace_file);
+        }
+        return served ? 0 : -1;
+    }
+
+    if (worker)
+    {
+        return run_worker(worker) ? 0 : -1;
+    }
+
+    // World, the scene generators and the BVH builder draw from this generator
+    seed_random(SCENE_SEED);
+    SceneSetup scene;
+    scene.aspect_ratio = aspect_ratio;
+    if (scene_file)
+    {
+        if (!Scene::load_scene_file(scene_file, scene)) exit(-1);
+    }
+    else if (!setup_scene(scene_idx, scene))
+    {
+        printf("[ERROR] Unknown scene [%d]\n", scene_idx);
+        exit(-1);
+    }
+    const Geometry::BVH::Node & world = scene.world;
+    aspect_ratio = scene.aspect_ratio;
+
+    if (denoise && stream_output)
+    {
+        printf("[WARNING] Denoising needs the full frame in memory, ignored while streaming\n");
+        denoise = false;
+    }
+    if (progressive && stream_output)
+    {
+        printf("[WARNING] Progressive rendering needs the full frame in memory, streaming ignored\n");
+        stream_output = nullptr;
     }
 
     int scr_w = static_cast<int>(scr_h * aspect_ratio);
-    Utility::Image image(scr_w, scr_h, 3);
+    Utility::Image image = stream_output ? Utility::Image() : Utility::Image(scr_w, scr_h, 3);
 
     // Camera
     float aperture = 0.1f;
     float focal_length = 10.0f;
-    Scene::Camera camera(eye, at, up, fov, aspect_ratio, aperture, focal_length, 1.0f);
+    Scene::Camera camera(scene.eye, scene.at, scene.up, scene.fov, aspect_ratio, aperture, focal_length, 1.0f);
+    camera.set_image_height(scr_h);
+
+    if (sequence)
+    {
+        if (!scene.animation)
+        {
+            printf("[ERROR] Rendering a sequence needs a scene file with frames\n");
+            exit(-1);
+        }
+        Scene::SequenceRenderer sequence_renderer(scene);
+        sequence_renderer.render(scr_w, scr_h, samples_per_pixel, max_depth, aperture, focal_length, "frame_");
+        if (trace_file && Utility::tracer().write_json(trace_file))
+        {
+            printf("[INFO] Trace saved to [%s]\n", trace_file);
+        }
+        return 0;
+    }
+
+    if (coordinator_port)
+    {
+        // Workers load the same scene by its file or number
+        std::string scene_key = scene_file ? std::string(scene_file) : std::to_string(scene_idx);
+        Utility::Accumulator distributed(scr_w, scr_h);
+        double start = wall_seconds();
+        Coordinator coordinator(scene_key, max_depth, samples_per_pixel, distributed);
+        if (!coordinator.run(coordinator_port)) exit(-1);
+        char total_time[DURATION_STR_LENGTH];
+        get_duration_str((float)(wall_seconds() - start), total_time);
+        printf("[INFO] Done! Total time: %s\n", total_time);
+
+        if (checkpoint_file && distributed.save(checkpoint_file))
+        {
+            printf("[INFO] Checkpoint saved to [%s]\n", checkpoint_file);
+        }
+        distributed.resolve(image);
+        image.save("result.png");
+        if (trace_file && Utility::tracer().write_json(trace_file))
+        {
+            printf("[INFO] Trace saved to [%s]\n", trace_file);
+        }
+        return 0;
+    }
 
     // Render
-    clock_t last_timestamp = clock();
-    clock_t start_timestamp = last_timestamp;
+    double last_timestamp = wall_seconds();
+    double start_timestamp = last_timestamp;
     float duration;
     char estimate_time[DURATION_STR_LENGTH];
-    int w_per_tile = (image.width() + tile - 1) / tile;
-    int h_per_tile = (image.height() + tile - 1) / tile;
+    int scanlines_done = 0;
+    int scanlines_total = scr_h * tile;         // every tile column covers the full height
+    int w_per_tile = (scr_w + tile - 1) / tile;
+    int h_per_tile = (scr_h + tile - 1) / tile;
 
     // Tiling
     std::vector<std::pair<int, int> > w_tiles;
     std::vector<std::pair<int, int> > h_tiles;
     for (int i = 0; i < tile; i++)
     {
-        w_tiles.push_back(std::make_pair<int, int>(i * w_per_tile, MIN((i + 1) * w_per_tile, image.width())));
-        h_tiles.push_back(std::make_pair<int, int>(i * h_per_tile, MIN((i + 1) * h_per_tile, image.height())));
+        w_tiles.push_back(std::make_pair<int, int>(i * w_per_tile, MIN((i + 1) * w_per_tile, scr_w)));
+        h_tiles.push_back(std::make_pair<int, int>(i * h_per_tile, MIN((i + 1) * h_per_tile, scr_h)));
+    }
+
+    // Progress snapshots are saved in background
+    Utility::AsyncImageWriter progress_writer("result.png");
+    shared_ptr<Utility::PFMTileWriter> tile_writer;
+    if (stream_output)
+    {
+        tile_writer = make_shared<Utility::PFMTileWriter>(stream_output, scr_w, scr_h);
+    }
+
+    // Checkpointing keeps the sample sums of the whole frame
+    shared_ptr<Utility::Accumulator> accumulator;
+    if (checkpoint_file && stream_output)
+    {
+        printf("[WARNING] Checkpointing needs the full frame in memory, ignored while streaming\n");
+    }
+    else if (checkpoint_file)
+    {
+        accumulator = make_shared<Utility::Accumulator>(scr_w, scr_h);
+        if (resume && accumulator->load(checkpoint_file))
+        {
+            if (accumulator->width() != scr_w || accumulator->height() != scr_h)
+            {
+                printf("[ERROR] Checkpoint [%s] is %dx%d but the image is %dx%d\n",
+                    checkpoint_file, accumulator->width(), accumulator->height(), scr_w, scr_h);
+                exit(-1);
+            }
+            printf("[INFO] Resuming from [%s] with %d samples per pixel done\n", checkpoint_file, accumulator->min_count());
+        }
+        else if (resume)
+        {
+            printf("[WARNING] No checkpoint at [%s], starting from scratch\n", checkpoint_file);
+            accumulator = make_shared<Utility::Accumulator>(scr_w, scr_h);
+        }
+    }
+    if (progressive && !accumulator)
+    {
+        accumulator = make_shared<Utility::Accumulator>(scr_w, scr_h);
+    }
+    time_t last_checkpoint = time(NULL);
+
+    shared_ptr<Utility::CostMaps> cost_maps;
+    if (heatmap_prefix)
+    {
+        cost_maps = make_shared<Utility::CostMaps>(scr_w, scr_h);
     }
 
     // Rendering
 #ifdef _OPENMP
     printf("[INFO] Omp max threads: %d\n", omp_get_max_threads());
 #endif
-    for (int tj = tile - 1; tj >= 0; tj--)
-    for (int ti = 0; ti < tile; ti++)
+    if (progressive)
     {
-        for (int j = h_tiles[tj].first; j < h_tiles[tj].second; j++)
+        // Rows are visited in a shuffled order, so a pass cut short by the
+        // deadline still spreads its samples over the whole frame
+        std::vector<int> rows(scr_h);
+        for (int j = 0; j < scr_h; j++) rows[j] = j;
+        std::shuffle(rows.begin(), rows.end(), std::mt19937(accumulator->seed()));
+
+        double deadline = start_timestamp + time_budget;
+        std::atomic<bool> out_of_time(false);
+        int total_spp = accumulator->min_count();
+        for (int pass_spp = 1; total_spp < samples_per_pixel && !out_of_time; pass_spp *= 2)
         {
+            TRACE_SCOPE_ARG("pass", pass_spp);
+            pass_spp = MIN(pass_spp, samples_per_pixel - total_spp);
 #ifdef _OPENMP
-#pragma omp parallel for
+#pragma omp parallel for schedule(dynamic)
 #endif
-            for (int i = w_tiles[ti].first; i < w_tiles[ti].second; i++)
+            for (int k = 0; k < scr_h; k++)
             {
-                vec4 pixel_color(0.0f, 0.0f, 0.0f, 1.0f);
-                for (int s = 0; s < samples_per_pixel; s++)
+                int j = rows[k];
+                TRACE_SCOPE_ARG("row", j);
+                for (int i = 0; i < scr_w && !out_of_time; i++)
                 {
-                    float u = ((float)i + random_float()) / (image.width() - 1);
-                    float v = ((float)j + random_float()) / (image.height() - 1);
-                    Geometry::Ray r = camera.get_ray(u, v);
-                    pixel_color += ray_color(r, world, max_depth);
+                    Utility::CostProbe probe(cost_maps != nullptr);
+                    accumulator->seed_pixel(i, j);
+                    int first = accumulator->count(i, j);
+                    int target = MIN(total_spp + pass_spp, samples_per_pixel);
+                    // Check the deadline between packets
+                    for (int s = first; s < target && !out_of_time; s += RAY_PACKET_SIZE)
+                    {
+                        if (time_budget > 0.0f && wall_seconds() >= deadline)
+                        {
+                            out_of_time = true;
+                            break;
+                        }
+                        trace_pixel(camera, world, i, j, scr_w, scr_h, MIN(RAY_PACKET_SIZE, target - s),
+                            max_depth, packet_tracing, [&](const vec4 & color) { accumulator->add(i, j, color); });
+                    }
+                    if (cost_maps) cost_maps->add(i, j, probe, accumulator->count(i, j) - first);
                 }
-                pixel_color *= 1.0f / samples_per_pixel;
-                WRITE_COLOR(image, i, j, pixel_color);
             }
-            duration = ((float)(clock() - last_timestamp) / CLOCKS_PER_SEC);
-            get_duration_str(duration * j, estimate_time);
-            printf("\r[INFO] Rendering tile [%d %d], Scanlines remaining: % 4d, % 5.2f scanlines per second, Estimated time left: %s    ",
-                tj, ti, h_tiles[tj].second - j, 1.0 / duration, estimate_time);
+            total_spp = accumulator->min_count();
+
+            accumulator->resolve(image);
+            progress_writer.submit(image);
+
+            float noise = accumulator->noise();
+            float elapsed = (float)(wall_seconds() - start_timestamp);
+            printf("\r[INFO] Pass of %d spp done, %d spp in total, noise %.4f, elapsed %.2fs    ",
+                pass_spp, total_spp, noise, elapsed);
             fflush(stdout);
-            last_timestamp = clock();
+
+            if (checkpoint_file && time(NULL) - last_checkpoint >= checkpoint_interval)
+            {
+                accumulator->save(checkpoint_file);
+                last_checkpoint = time(NULL);
+            }
+            if (noise_target > 0.0f && noise <= noise_target) break;
         }
-        image.save("result.png");
     }
-    
+    else
+    {
+        for (int tj = tile - 1; tj >= 0; tj--)
+        for (int ti = 0; ti < tile; ti++)
+        {
+            int tile_x = w_tiles[ti].first;
+            int tile_y = h_tiles[tj].first;
+            Utility::Image tile_image(w_tiles[ti].second - tile_x, h_tiles[tj].second - tile_y, 3);
+            TRACE_SCOPE_ARG("tile", tj * tile + ti);
+
+            for (int j = h_tiles[tj].first; j < h_tiles[tj].second; j++)
+            {
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+                {
+                    // Each thread's share of the scanline, the gaps show load imbalance
+                    TRACE_SCOPE_ARG("scanline", j);
+#ifdef _OPENMP
+#pragma omp for nowait
+#endif
+                    for (int i = w_tiles[ti].first; i < w_tiles[ti].second; i++)
+                    {
+                        vec4 pixel_color(0.0f, 0.0f, 0.0f, 1.0f);
+                        Utility::CostProbe probe(cost_maps != nullptr);
+                        int done = 0;
+                        if (accumulator)
+                        {
+                            done = accumulator->count(i, j);
+                            accumulator->seed_pixel(i, j);
+                        }
+                        else
+                        {
+                            seed_pixel(0, j * scr_w + i, 0);
+                        }
+                        trace_pixel(camera, world, i, j, scr_w, scr_h, MAX(samples_per_pixel - done, 0),
+                            max_depth, packet_tracing, [&](const vec4 & color) {
+                                if (accumulator) accumulator->add(i, j, color);
+                                else pixel_color += color;
+                            });
+                        if (cost_maps) cost_maps->add(i, j, probe, MAX(samples_per_pixel - done, 0));
+                        if (accumulator)
+                        {
+                            pixel_color = accumulator->average(i, j);
+                        }
+                        else
+                        {
+                            pixel_color *= 1.0f / samples_per_pixel;
+                        }
+                        WRITE_COLOR(tile_image, i - tile_x, j - tile_y, pixel_color);
+                    }
+                }
+                double now = wall_seconds();
+                duration = (float)(now - last_timestamp);
+                scanlines_done++;
+                get_duration_str((float)(now - start_timestamp) / scanlines_done * (scanlines_total - scanlines_done), estimate_time);
+                printf("\r[INFO] Rendering tile [%d %d], Scanlines remaining: % 4d, % 5.2f scanlines per second, Estimated time left: %s    ",
+                    tj, ti, h_tiles[tj].second - j, 1.0 / duration, estimate_time);
+                fflush(stdout);
+                last_timestamp = now;
+            }
+
+            if (tile_writer)
+            {
+                tile_writer->write_tile(tile_image, tile_x, tile_y);
+            }
+            else
+            {
+                image.paste(tile_image, tile_x, tile_y);
+                progress_writer.submit(image);
+            }
+
+            if (accumulator && time(NULL) - last_checkpoint >= checkpoint_interval)
+            {
+                accumulator->save(checkpoint_file);
+                last_checkpoint = time(NULL);
+            }
+        }
+    }
+
     printf("\n");
+    progress_writer.finish();
+
+    // Final checkpoint, resuming it with more samples refines the image
+    if (checkpoint_file && accumulator && accumulator->save(checkpoint_file))
+    {
+        printf("[INFO] Checkpoint saved to [%s]\n", checkpoint_file);
+    }
     
     char total_time[DURATION_STR_LENGTH];
-    duration = ((float)(clock() - start_timestamp) / CLOCKS_PER_SEC);
+    duration = (float)(wall_seconds() - start_timestamp);
     get_duration_str(duration, total_time);
     printf("[INFO] Done! Total time: %s\n", total_time);
 
+#ifdef RENDER_STATS
+    if (Utility::stats_registry().write_json("stats.json", duration))
+    {
+        printf("[INFO] Render stats saved to [stats.json]\n");
+    }
+#endif
+
     // Filtering Image
-    if (bilinear_filter)
+    if (tile_writer)
+    {
+        printf("[INFO] Image streamed to [%s]\n", stream_output);
+    }
+    else if (denoise)
+    {
+        Utility::Image albedo(scr_w, scr_h, 3);
+        Utility::Image normal(scr_w, scr_h, 3);
+        Utility::Image depth(scr_w, scr_h, 1);
+        {
+            TRACE_SCOPE("denoise guides");
+            render_aovs(camera, world, DENOISE_GUIDE_SAMPLES, albedo, normal, depth);
+        }
+        TRACE_SCOPE("denoise");
+        auto res = Utility::atrous_filtering(image, albedo, normal, depth, ATROUS_PASSES, 0.25f, 64.0f, 0.05f);
+        res.save("result.png");
+    }
+    else if (bilinear_filter)
     {
         auto res = Utility::bilateral_filtering(image, 9, 0.1f, 10.0f);
         res.save("result.png");
@@ -179,27 +453,15 @@ int main()
         image.save("result.png");
     }
 
-    return 0;
-}
-
-vec4 ray_color(const Geometry::Ray & r, const Geometry::Hittable & world, int depth)
-{
-    if (depth <= 0) return COLOR_BLACK;
+    if (cost_maps)
+    {
+        cost_maps->save(heatmap_prefix);
+    }
 
-    Geometry::HitRecord rec;
-    if (world.hit(r, 0.001f, FLOAT_INFINITY, rec))
+    if (trace_file && Utility::tracer().write_json(trace_file))
     {
-        Geometry::Ray scattered;
-        vec4 attenuation;
-        vec4 emissive = rec.material->emitted();
-        if (rec.material->scatter(r, rec, attenuation, scattered))
-        {
-            return emissive + attenuation * ray_color(scattered, world, depth - 1);
-        }
-        return emissive;
+        printf("[INFO] Trace saved to [%s]\n", trace_file);
     }
-    // return COLOR_BLACK;
-    vec3 unit_direction = glm::normalize(r.direction());
-    float k = (unit_direction.y + 1.0f) * 0.5f;
-    return LERP(COLOR_WHITE, COLOR_SKY, k);
-}
\ No newline at end of file
+
+    return 0;
+}
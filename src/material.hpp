@@ -7,6 +7,9 @@
 
 using std::make_shared;
 
+// Footprint spread of diffuse bounces, wide lobes need only coarse texture levels
+#define RAY_CONE_DIFFUSE_SPREAD 0.1f
+
 namespace Material
 {
 
@@ -20,18 +23,44 @@ public:
     virtual vec4 emitted() const {
         return vec4(0.0f, 0.0f, 0.0f, 1.0f);
     }
+
+    // Surface colour at a hit, guides denoising
+    virtual vec4 albedo(const Geometry::Ray & r_in, const Geometry::HitRecord & rec) const {
+        return COLOR_WHITE;
+    }
+
+    // Primitives may skip computing uv of hit records when false
+    virtual bool uses_uv() const { return true; }
 };
 
+inline Utility::MemoryCategory memory_category(const Material *) { return Utility::MEMORY_MATERIALS; }
+
+bool uses_uv(const shared_ptr<Material> & material)
+{
+    return material->uses_uv();
+}
+
 class Lambertian : public Material
 {
 private:
     shared_ptr<Utility::Texture> m_albedo;
+    bool m_uses_uv;
+
+    /**
+     * Footprint for the texture lookup, objects leave the uv scale unset
+     * for materials that don't use uv
+     */
+    float footprint(const Geometry::Ray & r_in, const Geometry::HitRecord & rec) const
+    {
+        return m_uses_uv ? rec.uv_footprint(r_in) : 0.0f;
+    }
 
 public:
     Lambertian(const vec4 & albedo): 
-        m_albedo(make_shared<Utility::SolidColor>(albedo)) {}
+        m_albedo(Utility::make_scene_shared<Utility::SolidColor>(albedo)),
+        m_uses_uv(false) {}
 
-    Lambertian(shared_ptr<Utility::Texture> texture): m_albedo(texture) {}
+    Lambertian(shared_ptr<Utility::Texture> texture): m_albedo(texture), m_uses_uv(texture->uses_uv()) {}
 
     virtual bool scatter(
         const Geometry::Ray & r_in, const Geometry::HitRecord & rec, vec4 & attenuation, Geometry::Ray & scattered
@@ -45,10 +74,19 @@ public:
             scatter_direction = rec.normal;
         }
 
-        scattered = Geometry::Ray(rec.point, scatter_direction, r_in.time());
-        attenuation = m_albedo->value(rec.u, rec.v, rec.point);
+        scattered = Geometry::Ray(rec.point, scatter_direction, r_in.time(), r_in.width_at(rec.t), RAY_CONE_DIFFUSE_SPREAD);
+        {
+            STATS_TIMER(texture_ns);
+            attenuation = m_albedo->value(rec.u, rec.v, rec.point, footprint(r_in, rec));
+        }
         return true;
     }
+
+    virtual vec4 albedo(const Geometry::Ray & r_in, const Geometry::HitRecord & rec) const override {
+        return m_albedo->value(rec.u, rec.v, rec.point, footprint(r_in, rec));
+    }
+
+    virtual bool uses_uv() const override { return m_uses_uv; }
 };
 
 class Metal : public Material
@@ -67,10 +105,17 @@ public:
     ) const override
     {
         vec3 reflected = glm::reflect(glm::normalize(r_in.direction()), rec.normal);
-        scattered = Geometry::Ray(rec.point, reflected + m_fuzz * random_in_unit_sphere(), r_in.time());
+        scattered = Geometry::Ray(rec.point, reflected + m_fuzz * random_in_unit_sphere(), r_in.time(),
+                                  r_in.width_at(rec.t), r_in.spread() + m_fuzz);
         attenuation = m_albedo;
         return (glm::dot(scattered.direction(), rec.normal) > 0);
     }
+
+    virtual vec4 albedo(const Geometry::Ray & r_in, const Geometry::HitRecord & rec) const override {
+        return m_albedo;
+    }
+
+    virtual bool uses_uv() const override { return false; }
 };
 
 vec3 refract(const vec3 & uv, const vec3 & n, float etai_over_etat) {
@@ -115,9 +160,11 @@ public:
         else
             direction = refract(unit_direction, rec.normal, refraction_ratio);
 
-        scattered = Geometry::Ray(rec.point, direction, r_in.time());
+        scattered = Geometry::Ray(rec.point, direction, r_in.time(), r_in.width_at(rec.t), r_in.spread());
         return true;
     }
+
+    virtual bool uses_uv() const override { return false; }
 };
 
 class DiffuseLight : public Material
@@ -139,6 +186,8 @@ public:
     virtual vec4 emitted() const override {
         return m_color;
     }
+
+    virtual bool uses_uv() const override { return false; }
 };
 
 }
@@ -0,0 +1,139 @@
+#ifndef __MEMORY_HPP__
+#define __MEMORY_HPP__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <atomic>
+#include <new>
+
+namespace Utility
+{
+
+enum MemoryCategory
+{
+    MEMORY_GEOMETRY,        // primitives and instances
+    MEMORY_BVH,             // BVH nodes
+    MEMORY_MATERIALS,
+    MEMORY_TEXTURES,        // texture objects and texels
+    MEMORY_MESH_DATA,       // vertices and indices read from obj files
+    MEMORY_CONTROL_BLOCKS,  // shared_ptr reference counts next to scene objects
+    MEMORY_FRAMEBUFFER,     // float images and sample accumulation
+    MEMORY_OTHER,
+    MEMORY_CATEGORY_NUM
+};
+
+const char * MEMORY_CATEGORY_NAMES[MEMORY_CATEGORY_NUM] = {
+    "geometry", "bvh", "materials", "textures", "mesh data", "control blocks", "framebuffer", "other"
+};
+
+/**
+ * Live bytes and allocations of each subsystem with their peaks. Counts
+ * scene objects made in a scene arena and the buffers that allocate
+ * through counted allocators, not every allocation of the program.
+ */
+class MemoryStats
+{
+private:
+    std::atomic<long long> m_bytes[MEMORY_CATEGORY_NUM];
+    std::atomic<long long> m_peak[MEMORY_CATEGORY_NUM];
+    std::atomic<long long> m_count[MEMORY_CATEGORY_NUM];
+    std::atomic<long long> m_total;
+    std::atomic<long long> m_total_peak;
+
+    static void raise(std::atomic<long long> & peak, long long value)
+    {
+        long long current = peak.load();
+        while (value > current && !peak.compare_exchange_weak(current, value)) {}
+    }
+
+public:
+    MemoryStats(): m_total(0), m_total_peak(0)
+    {
+        for (int i = 0; i < MEMORY_CATEGORY_NUM; i++)
+        {
+            m_bytes[i] = 0;
+            m_peak[i] = 0;
+            m_count[i] = 0;
+        }
+    }
+
+    void add(MemoryCategory category, size_t bytes, long long count = 1)
+    {
+        raise(m_peak[category], m_bytes[category] += bytes);
+        raise(m_total_peak, m_total += bytes);
+        m_count[category] += count;
+    }
+
+    void remove(MemoryCategory category, size_t bytes, long long count = 1)
+    {
+        m_bytes[category] -= bytes;
+        m_total -= bytes;
+        m_count[category] -= count;
+    }
+
+    long long bytes(MemoryCategory category) const { return m_bytes[category]; }
+    long long peak(MemoryCategory category) const { return m_peak[category]; }
+    long long count(MemoryCategory category) const { return m_count[category]; }
+
+    void print() const
+    {
+        printf("[INFO] Memory           current        peak   allocations\n");
+        for (int i = 0; i < MEMORY_CATEGORY_NUM; i++)
+        {
+            printf("       %-14s %8.1f KB %8.1f KB %13lld\n", MEMORY_CATEGORY_NAMES[i],
+                m_bytes[i] / 1024.0, m_peak[i] / 1024.0, m_count[i].load());
+        }
+        printf("       %-14s %8.1f KB %8.1f KB\n", "total", m_total / 1024.0, m_total_peak / 1024.0);
+    }
+};
+
+inline MemoryStats & memory_stats()
+{
+    static MemoryStats stats;
+    return stats;
+}
+
+/**
+ * Standard allocator that counts its buffers towards a category
+ */
+template <typename T, MemoryCategory category>
+struct CountedAllocator
+{
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind { typedef CountedAllocator<U, category> other; };
+
+    CountedAllocator() {}
+
+    template <typename U>
+    CountedAllocator(const CountedAllocator<U, category> &) {}
+
+    T * allocate(size_t count)
+    {
+        memory_stats().add(category, count * sizeof(T));
+        return static_cast<T *>(::operator new(count * sizeof(T)));
+    }
+
+    void deallocate(T * p, size_t count)
+    {
+        memory_stats().remove(category, count * sizeof(T));
+        ::operator delete(p);
+    }
+};
+
+template <typename T, typename U, MemoryCategory category>
+bool operator==(const CountedAllocator<T, category> &, const CountedAllocator<U, category> &) { return true; }
+
+template <typename T, typename U, MemoryCategory category>
+bool operator!=(const CountedAllocator<T, category> &, const CountedAllocator<U, category> &) { return false; }
+
+/**
+ * Category of scene objects of types without one of their own, overloads
+ * next to the object types pick theirs
+ */
+inline MemoryCategory memory_category(const void *) { return MEMORY_OTHER; }
+
+} // namespace Utility
+
+#endif
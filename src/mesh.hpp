@@ -9,6 +9,7 @@
 #include "thirdparty/tinyobjloader/tiny_obj_loader.h"
 #include "global.hpp"
 #include "geometry.hpp"
+#include "memory.hpp"
 
 namespace Utility
 {
@@ -22,9 +23,13 @@ struct Vertex
 
 class Mesh
 {
+public:
+    typedef std::vector<Vertex, CountedAllocator<Vertex, MEMORY_MESH_DATA> > Vertices;
+    typedef std::vector<size_t, CountedAllocator<size_t, MEMORY_MESH_DATA> > Indices;
+
 private:
-    std::vector<Vertex> m_vertices;
-    std::vector<size_t> m_indices;
+    Vertices m_vertices;
+    Indices m_indices;
 
 public:
     Mesh(const char * filename)
@@ -91,8 +96,8 @@ public:
         }
     }
 
-    const std::vector<Vertex> & vertices() const { return m_vertices; }
-    const std::vector<size_t> & indices() const { return m_indices; }
+    const Vertices & vertices() const { return m_vertices; }
+    const Indices & indices() const { return m_indices; }
 };
 
 float vec3_length(const vec3 & vec)
@@ -102,6 +107,7 @@ float vec3_length(const vec3 & vec)
 
 Geometry::BVH::Node load_mesh(const char * filename, shared_ptr<Material::Material> material, vec3 scale, vec3 translate)
 {
+    TRACE_SCOPE("mesh load");
     Mesh mesh(filename);
 
     Geometry::HittableList triangles;
@@ -111,7 +117,7 @@ Geometry::BVH::Node load_mesh(const char * filename, shared_ptr<Material::Materi
         bool has_normal = fabs(vec3_length(mesh.vertices()[mesh.indices()[fidx]].normal)) > EPSILON;
         if (has_normal)
         {
-            triangles.add(make_shared<Geometry::Triangle>(
+            triangles.add(make_scene_shared<Geometry::Triangle>(
                 mesh.vertices()[mesh.indices()[fidx    ]].position * scale + translate,
                 mesh.vertices()[mesh.indices()[fidx + 1]].position * scale + translate,
                 mesh.vertices()[mesh.indices()[fidx + 2]].position * scale + translate,
@@ -122,7 +128,7 @@ Geometry::BVH::Node load_mesh(const char * filename, shared_ptr<Material::Materi
         }
         else
         {
-            triangles.add(make_shared<Geometry::Triangle>(
+            triangles.add(make_scene_shared<Geometry::Triangle>(
                 mesh.vertices()[mesh.indices()[fidx    ]].position * scale + translate,
                 mesh.vertices()[mesh.indices()[fidx + 1]].position * scale + translate,
                 mesh.vertices()[mesh.indices()[fidx + 2]].position * scale + translate,
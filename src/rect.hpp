@@ -21,6 +21,7 @@ private:
     float m_a0, m_a1;
     float m_b0, m_b1;
     float m_k;
+    float m_uv_scale;
     shared_ptr<Material::Material> m_material;
     AxisAlignedRectType m_type;
 
@@ -28,7 +29,10 @@ public:
     AxisAlignedRect() = delete;
 
     AxisAlignedRect(float a0, float a1, float b0, float b1, float k, AxisAlignedRectType type, shared_ptr<Material::Material> mat):
-        m_a0(a0), m_a1(a1), m_b0(b0), m_b1(b1), m_k(k), m_type(type), m_material(mat) {}
+        m_a0(a0), m_a1(a1), m_b0(b0), m_b1(b1), m_k(k), m_type(type), m_material(mat)
+    {
+        m_uv_scale = 1.0f / MIN(a1 - a0, b1 - b0);
+    }
 
 
     virtual bool hit(const Ray & r, float t_min, float t_max, HitRecord & rec) const override;
@@ -55,6 +59,7 @@ bool AxisAlignedRect::bounding_box(float time0, float time1, AABB & output_box)
 
 bool AxisAlignedRect::hit(const Ray & r, float t_min, float t_max, HitRecord & rec) const
 {
+    STATS_COUNT(primitive_tests);
     float t;
     switch (m_type)
     {
@@ -95,6 +100,7 @@ bool AxisAlignedRect::hit(const Ray & r, float t_min, float t_max, HitRecord & r
 
     rec.u = (a - m_a0) / (m_a1 - m_a0);
     rec.v = (b - m_b0) / (m_b1 - m_b0);
+    rec.uv_scale = m_uv_scale;
     rec.t = t;
     vec3 outward_normal;
     switch (m_type)
@@ -130,14 +136,14 @@ public:
 Box::Box(const vec3 & min, const vec3 & max, shared_ptr<Material::Material> mat):
     m_min(min), m_max(max)
 {
-    m_sides.add(make_shared<AxisAlignedRect>(min.x, max.x, min.y, max.y, min.z, AxisAlignedRectType::RECT_XY, mat));
-    m_sides.add(make_shared<AxisAlignedRect>(min.x, max.x, min.y, max.y, max.z, AxisAlignedRectType::RECT_XY, mat));
+    m_sides.add(Utility::make_scene_shared<AxisAlignedRect>(min.x, max.x, min.y, max.y, min.z, AxisAlignedRectType::RECT_XY, mat));
+    m_sides.add(Utility::make_scene_shared<AxisAlignedRect>(min.x, max.x, min.y, max.y, max.z, AxisAlignedRectType::RECT_XY, mat));
 
-    m_sides.add(make_shared<AxisAlignedRect>(min.x, max.x, min.z, max.z, min.y, AxisAlignedRectType::RECT_XZ, mat));
-    m_sides.add(make_shared<AxisAlignedRect>(min.x, max.x, min.z, max.z, max.y, AxisAlignedRectType::RECT_XZ, mat));
+    m_sides.add(Utility::make_scene_shared<AxisAlignedRect>(min.x, max.x, min.z, max.z, min.y, AxisAlignedRectType::RECT_XZ, mat));
+    m_sides.add(Utility::make_scene_shared<AxisAlignedRect>(min.x, max.x, min.z, max.z, max.y, AxisAlignedRectType::RECT_XZ, mat));
 
-    m_sides.add(make_shared<AxisAlignedRect>(min.y, max.y, min.z, max.z, min.x, AxisAlignedRectType::RECT_YZ, mat));
-    m_sides.add(make_shared<AxisAlignedRect>(min.y, max.y, min.z, max.z, max.x, AxisAlignedRectType::RECT_YZ, mat));
+    m_sides.add(Utility::make_scene_shared<AxisAlignedRect>(min.y, max.y, min.z, max.z, min.x, AxisAlignedRectType::RECT_YZ, mat));
+    m_sides.add(Utility::make_scene_shared<AxisAlignedRect>(min.y, max.y, min.z, max.z, max.x, AxisAlignedRectType::RECT_YZ, mat));
 }
 
 bool Box::hit(const Ray & r, float t_min, float t_max, HitRecord & rec) const
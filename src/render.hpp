@@ -0,0 +1,160 @@
+#ifndef __RENDER_HPP__
+#define __RENDER_HPP__
+
+#include "global.hpp"
+#include "geometry.hpp"
+#include "material.hpp"
+#include "camera.hpp"
+#include "stats.hpp"
+
+// Seed of the random streams of the denoiser guide rays
+#define AOV_SEED 0x9e3779b9u
+
+vec4 ray_color(const Geometry::Ray & r, const Geometry::Hittable & world, int depth);
+
+/**
+ * Radiance along a ray given the result of its closest hit query
+ */
+vec4 shade(const Geometry::Ray & r, bool hit, const Geometry::HitRecord & rec, const Geometry::Hittable & world, int depth)
+{
+    if (hit)
+    {
+        Geometry::Ray scattered;
+        vec4 attenuation;
+        vec4 emissive = rec.material->emitted();
+        bool scatter;
+        {
+            STATS_TIMER(shading_ns);
+            scatter = rec.material->scatter(r, rec, attenuation, scattered);
+        }
+        if (scatter)
+        {
+            return emissive + attenuation * ray_color(scattered, world, depth - 1);
+        }
+        return emissive;
+    }
+    // return COLOR_BLACK;
+    vec3 unit_direction = glm::normalize(r.direction());
+    float k = (unit_direction.y + 1.0f) * 0.5f;
+    return LERP(COLOR_WHITE, COLOR_SKY, k);
+}
+
+/**
+ * Radiance along a ray, traced recursively up to depth bounces
+ */
+vec4 ray_color(const Geometry::Ray & r, const Geometry::Hittable & world, int depth)
+{
+    if (depth <= 0) return COLOR_BLACK;
+
+    STATS_COUNT(rays);
+    Geometry::HitRecord rec;
+    bool hit;
+    {
+        STATS_TIMER(intersect_ns);
+        hit = world.hit(r, 0.001f, FLOAT_INFINITY, rec);
+    }
+    return shade(r, hit, rec, world, depth);
+}
+
+/**
+ * Trace count samples of pixel (i, j) of a width x height image and hand
+ * each color to sink. With packets, the camera rays of RAY_PACKET_SIZE
+ * samples go through the BVH together before being shaded one by one.
+ */
+template <typename Sink>
+void trace_pixel(const Scene::Camera & camera, const Geometry::Hittable & world,
+                 int i, int j, int width, int height, int count, int max_depth, bool packets, Sink sink)
+{
+    if (!packets || max_depth <= 0)
+    {
+        for (int s = 0; s < count; s++)
+        {
+            float u = ((float)i + random_float()) / (width - 1);
+            float v = ((float)j + random_float()) / (height - 1);
+            sink(ray_color(camera.get_ray(u, v), world, max_depth));
+        }
+        return;
+    }
+
+    for (int s = 0; s < count; s += RAY_PACKET_SIZE)
+    {
+        Geometry::RayPacket packet;
+        for (int k = 0; k < MIN(RAY_PACKET_SIZE, count - s); k++)
+        {
+            float u = ((float)i + random_float()) / (width - 1);
+            float v = ((float)j + random_float()) / (height - 1);
+            packet.add(camera.get_ray(u, v));
+        }
+        packet.prepare();
+
+        float t_max[RAY_PACKET_SIZE];
+        Geometry::HitRecord recs[RAY_PACKET_SIZE];
+        for (int k = 0; k < RAY_PACKET_SIZE; k++) t_max[k] = FLOAT_INFINITY;
+        unsigned int hits;
+        {
+            STATS_TIMER(intersect_ns);
+            hits = world.hit_packet(packet, packet.all(), 0.001f, t_max, recs);
+        }
+
+        for (int k = 0; k < packet.size(); k++)
+        {
+            STATS_COUNT(rays);
+            sink(shade(packet.ray(k), (hits >> k) & 1u, recs[k], world, max_depth));
+        }
+    }
+}
+
+/**
+ * Albedo, normal and distance of the first hit of camera rays, averaged over
+ * count jittered rays per pixel, for guiding the denoiser. Pixels whose rays
+ * miss everything get a white albedo, no normal and depth 0.
+ */
+void render_aovs(const Scene::Camera & camera, const Geometry::Hittable & world, int count,
+                 Utility::Image & albedo, Utility::Image & normal, Utility::Image & depth)
+{
+    int width = albedo.width();
+    int height = albedo.height();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int j = 0; j < height; j++)
+    for (int i = 0; i < width; i++)
+    {
+        // A stream of its own, the beauty samples stay as they were
+        seed_pixel(AOV_SEED, j * width + i, 0);
+        vec4 albedo_sum(0.0f);
+        vec3 normal_sum(0.0f);
+        float depth_sum = 0.0f;
+        int hits = 0;
+        for (int s = 0; s < count; s++)
+        {
+            float u = ((float)i + random_float()) / (width - 1);
+            float v = ((float)j + random_float()) / (height - 1);
+            Geometry::Ray r = camera.get_ray(u, v);
+            Geometry::HitRecord rec;
+            if (world.hit(r, 0.001f, FLOAT_INFINITY, rec))
+            {
+                albedo_sum += rec.material->albedo(r, rec);
+                normal_sum += rec.normal;
+                depth_sum += rec.t * glm::length(r.direction());
+                hits++;
+            }
+            else
+            {
+                albedo_sum += COLOR_WHITE;
+            }
+        }
+
+        vec4 pixel_albedo = albedo_sum / (float)count;
+        vec3 pixel_normal = glm::length(normal_sum) > 0.0f ? glm::normalize(normal_sum) : vec3(0.0f);
+        for (int c = 0; c < 3; c++)
+        {
+            albedo(i, j, c) = pixel_albedo[c];
+            normal(i, j, c) = pixel_normal[c];
+        }
+        // Pixels on a silhouette count as hits at the average distance of their hits
+        depth(i, j, 0) = hits > 0 ? depth_sum / hits : 0.0f;
+    }
+}
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef __SCENE_HPP__
 #define __SCENE_HPP__
 
+#include <map>
+#include <string>
+#include <vector>
 #include "global.hpp"
 #include "geometry.hpp"
 #include "rect.hpp"
@@ -9,6 +12,7 @@
 
 using std::make_shared;
 using std::shared_ptr;
+using Utility::make_scene_shared;
 
 #define RANDOM_COLOR() random_vec3()
 
@@ -16,9 +20,9 @@ Geometry::BVH::Node generate_random_scene() {
     Geometry::HittableList world;
 
     // auto ground_material = make_shared<Material::Lambertian>(vec4(0.5f, 0.5f, 0.5f, 1.0f));
-    auto checker = make_shared<Utility::CheckerTexture>(vec4(0.2f, 0.3f, 0.1f, 1.0f), vec4(0.9f, 0.9f, 0.9f, 1.0f));
-    auto ground_material = make_shared<Material::Lambertian>(checker);
-    world.add(make_shared<Geometry::Sphere>(vec3(0.0f, -1000.0f, 0.0f), 1000.0f, ground_material));
+    auto checker = make_scene_shared<Utility::CheckerTexture>(vec4(0.2f, 0.3f, 0.1f, 1.0f), vec4(0.9f, 0.9f, 0.9f, 1.0f));
+    auto ground_material = make_scene_shared<Material::Lambertian>(checker);
+    world.add(make_scene_shared<Geometry::Sphere>(vec3(0.0f, -1000.0f, 0.0f), 1000.0f, ground_material));
 
     for (int a = -11; a < 11; a++)
     {
@@ -34,32 +38,31 @@ Geometry::BVH::Node generate_random_scene() {
                 {
                     // diffuse
                     vec4 albedo = vec4(RANDOM_COLOR() * RANDOM_COLOR(), 1.0f);
-                    sphere_material = make_shared<Material::Lambertian>(albedo);
+                    sphere_material = make_scene_shared<Material::Lambertian>(albedo);
                     vec3 center1 = center + vec3(0, random_float(0, 0.5f), 0);
-                    world.add(make_shared<Geometry::Sphere>(center, 0.2f, sphere_material));
-                    // world.add(make_shared<Geometry::MovingSphere>(center, center1, 0.0f, 1.0f, 0.2f, sphere_material));
+                    world.add(make_scene_shared<Geometry::MovingSphere>(center, center1, 0.0f, 1.0f, 0.2f, sphere_material));
                 }
                 else if (material_choice < 0.95)
                 {
                     // metal
                     vec4 albedo = vec4(RANDOM_COLOR() * 0.5f + 0.5f, 1.0f);
                     float fuzz = random_float(0.0f, 0.5f);
-                    sphere_material = make_shared<Material::Metal>(albedo, fuzz);
-                    world.add(make_shared<Geometry::Sphere>(center, 0.2f, sphere_material));
+                    sphere_material = make_scene_shared<Material::Metal>(albedo, fuzz);
+                    world.add(make_scene_shared<Geometry::Sphere>(center, 0.2f, sphere_material));
                 }
                 else
                 {
                     // glass
-                    sphere_material = make_shared<Material::Dielectric>(1.5f);
-                    world.add(make_shared<Geometry::Sphere>(center, 0.2f, sphere_material));
+                    sphere_material = make_scene_shared<Material::Dielectric>(1.5f);
+                    world.add(make_scene_shared<Geometry::Sphere>(center, 0.2f, sphere_material));
                 }
             }
         }
     }
 
-    auto material1 = make_shared<Material::Dielectric>(1.5);
-    auto material2 = make_shared<Material::Lambertian>(vec4(0.4f, 0.2f, 0.1f, 1.0f));
-    auto material3 = make_shared<Material::Metal>(vec4(0.7f, 0.6f, 0.5f, 1.0f), 0.0f);
+    auto material1 = make_scene_shared<Material::Dielectric>(1.5);
+    auto material2 = make_scene_shared<Material::Lambertian>(vec4(0.4f, 0.2f, 0.1f, 1.0f));
+    auto material3 = make_scene_shared<Material::Metal>(vec4(0.7f, 0.6f, 0.5f, 1.0f), 0.0f);
 
     // world.add(make_shared<Geometry::Triangle>(
     //     vec3( 0.0f, 2.0f, 2.0f),
@@ -68,9 +71,9 @@ Geometry::BVH::Node generate_random_scene() {
     //     ground_material
     // ));
 
-    world.add(make_shared<Geometry::Sphere>(vec3( 0.0f, 1.0f, 0.0f), 1.0f, material1));
-    world.add(make_shared<Geometry::Sphere>(vec3(-4.0f, 1.0f, 0.0f), 1.0f, material2));
-    world.add(make_shared<Geometry::Sphere>(vec3( 4.0f, 1.0f, 0.0f), 1.0f, material3));
+    world.add(make_scene_shared<Geometry::Sphere>(vec3( 0.0f, 1.0f, 0.0f), 1.0f, material1));
+    world.add(make_scene_shared<Geometry::Sphere>(vec3(-4.0f, 1.0f, 0.0f), 1.0f, material2));
+    world.add(make_scene_shared<Geometry::Sphere>(vec3( 4.0f, 1.0f, 0.0f), 1.0f, material3));
 
     return Geometry::BVH::Node(world, 0.0f, 1.0f);
 }
@@ -78,29 +81,29 @@ Geometry::BVH::Node generate_random_scene() {
 Geometry::BVH::Node generate_simple_scene() {
     Geometry::HittableList world;
 
-    auto ground_material = make_shared<Material::Lambertian>(vec4(0.5f, 0.5f, 0.5f, 1.0f));
-    world.add(make_shared<Geometry::Sphere>(vec3(0.0f, -1000.0f, 0.0f), 1000.0f, ground_material));
+    auto ground_material = make_scene_shared<Material::Lambertian>(vec4(0.5f, 0.5f, 0.5f, 1.0f));
+    world.add(make_scene_shared<Geometry::Sphere>(vec3(0.0f, -1000.0f, 0.0f), 1000.0f, ground_material));
 
-    auto material1 = make_shared<Material::Dielectric>(1.5);
-    auto material2 = make_shared<Material::Lambertian>(vec4(0.4f, 0.2f, 0.1f, 1.0f));
-    auto material3 = make_shared<Material::Metal>(vec4(0.7f, 0.6f, 0.5f, 1.0f), 0.0f);
-    world.add(make_shared<Geometry::Sphere>(vec3( 0.0f, 1.0f, 0.0f),  1.0f, material1));
-    world.add(make_shared<Geometry::Sphere>(vec3( 0.0f, 1.0f, 0.0f), -0.9f, material1));
-    world.add(make_shared<Geometry::Sphere>(vec3(-2.0f, 1.0f, 2.0f), 1.0f, material1));
-    world.add(make_shared<Geometry::Sphere>(vec3( 2.0f, 1.0f, 2.0f), 1.0f, material1));
+    auto material1 = make_scene_shared<Material::Dielectric>(1.5);
+    auto material2 = make_scene_shared<Material::Lambertian>(vec4(0.4f, 0.2f, 0.1f, 1.0f));
+    auto material3 = make_scene_shared<Material::Metal>(vec4(0.7f, 0.6f, 0.5f, 1.0f), 0.0f);
+    world.add(make_scene_shared<Geometry::Sphere>(vec3( 0.0f, 1.0f, 0.0f),  1.0f, material1));
+    world.add(make_scene_shared<Geometry::Sphere>(vec3( 0.0f, 1.0f, 0.0f), -0.9f, material1));
+    world.add(make_scene_shared<Geometry::Sphere>(vec3(-2.0f, 1.0f, 2.0f), 1.0f, material1));
+    world.add(make_scene_shared<Geometry::Sphere>(vec3( 2.0f, 1.0f, 2.0f), 1.0f, material1));
 
-    auto material4 = make_shared<Material::DiffuseLight>(vec4(1.0f, 1.0f, 1.0f, 1.0f));
-    world.add(make_shared<Geometry::Triangle>(
+    auto material4 = make_scene_shared<Material::DiffuseLight>(vec4(1.0f, 1.0f, 1.0f, 1.0f));
+    world.add(make_scene_shared<Geometry::Triangle>(
         vec3(-3.0f, 0.0f, -2.0f),
         vec3( 0.0f, 4.0f, -2.0f),
         vec3( 3.0f, 0.0f, -2.0f),
         material4));
-    world.add(make_shared<Geometry::Triangle>(
+    world.add(make_scene_shared<Geometry::Triangle>(
         vec3(-4.0f, 0.0f, 0.0f),
         vec3(-4.0f, 4.0f, 0.0f),
         vec3(-4.0f, 0.0f, 4.0f),
         material4));
-    world.add(make_shared<Geometry::Triangle>(
+    world.add(make_scene_shared<Geometry::Triangle>(
         vec3( 4.0f, 0.0f, 0.0f),
         vec3( 4.0f, 4.0f, 0.0f),
         vec3( 4.0f, 0.0f, 4.0f),
@@ -113,9 +116,9 @@ Geometry::BVH::Node generate_two_perlin_spheres()
 {
     Geometry::HittableList world;
 
-    auto pertext = make_shared<Utility::NoiseTexturePos>(4.0f);
-    world.add(make_shared<Geometry::Sphere>(vec3(0.0f, -1000.0f, 0.0f), 1000.0f, make_shared<Material::Lambertian>(pertext)));
-    world.add(make_shared<Geometry::Sphere>(vec3(0.0f,     2.0f, 0.0f),    2.0f, make_shared<Material::Lambertian>(pertext)));
+    auto pertext = make_scene_shared<Utility::NoiseTexturePos>(4.0f);
+    world.add(make_scene_shared<Geometry::Sphere>(vec3(0.0f, -1000.0f, 0.0f), 1000.0f, make_scene_shared<Material::Lambertian>(pertext)));
+    world.add(make_scene_shared<Geometry::Sphere>(vec3(0.0f,     2.0f, 0.0f),    2.0f, make_scene_shared<Material::Lambertian>(pertext)));
 
     return Geometry::BVH::Node(world, 0.0f, 1.0f);
 }
@@ -124,8 +127,8 @@ Geometry::BVH::Node generate_earth()
 {
     Geometry::HittableList world;
 
-    auto earth_tex = make_shared<Utility::ImageTexture>("assets/texture/earthmap.jpg");
-    world.add(make_shared<Geometry::Sphere>(vec3(0.0f, 0.0f, 0.0f), 2.0f, make_shared<Material::Lambertian>(earth_tex)));
+    auto earth_tex = make_scene_shared<Utility::ImageTexture>("assets/texture/earthmap.jpg");
+    world.add(make_scene_shared<Geometry::Sphere>(vec3(0.0f, 0.0f, 0.0f), 2.0f, make_scene_shared<Material::Lambertian>(earth_tex)));
 
     return Geometry::BVH::Node(world, 0.0f, 1.0f);
 }
@@ -134,23 +137,23 @@ Geometry::BVH::Node generate_cornell_box()
 {
     Geometry::HittableList world;
 
-    auto red   = make_shared<Material::Lambertian>(vec4(.65, .05, .05, 1));
-    auto white = make_shared<Material::Lambertian>(vec4(.73, .73, .73, 1));
-    auto green = make_shared<Material::Lambertian>(vec4(.12, .45, .15, 1));
-    auto light = make_shared<Material::DiffuseLight>(vec4(15, 15, 15, 1));
+    auto red   = make_scene_shared<Material::Lambertian>(vec4(.65, .05, .05, 1));
+    auto white = make_scene_shared<Material::Lambertian>(vec4(.73, .73, .73, 1));
+    auto green = make_scene_shared<Material::Lambertian>(vec4(.12, .45, .15, 1));
+    auto light = make_scene_shared<Material::DiffuseLight>(vec4(15, 15, 15, 1));
 
     using Geometry::AxisAlignedRectType;
 
-    world.add(make_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_YZ, green));
-    world.add(make_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555,   0, AxisAlignedRectType::RECT_YZ, red  ));
-    world.add(make_shared<Geometry::AxisAlignedRect>(200, 355, 200, 355, 554, AxisAlignedRectType::RECT_XZ, light));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_YZ, green));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555,   0, AxisAlignedRectType::RECT_YZ, red  ));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(200, 355, 200, 355, 554, AxisAlignedRectType::RECT_XZ, light));
     // world.add(make_shared<Geometry::AxisAlignedRect>(213, 343, 227, 332, 554, AxisAlignedRectType::RECT_XZ, light));
-    world.add(make_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555,   0, AxisAlignedRectType::RECT_XZ, white));
-    world.add(make_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_XZ, white));
-    world.add(make_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_XY, white));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555,   0, AxisAlignedRectType::RECT_XZ, white));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_XZ, white));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_XY, white));
 
-    world.add(make_shared<Geometry::Box>(vec3(130, 0, 65),  vec3(295, 165, 230), white));
-    world.add(make_shared<Geometry::Box>(vec3(265, 0, 295), vec3(430, 330, 460), white));
+    world.add(make_scene_shared<Geometry::Box>(vec3(130, 0, 65),  vec3(295, 165, 230), white));
+    world.add(make_scene_shared<Geometry::Box>(vec3(265, 0, 295), vec3(430, 330, 460), white));
 
     return Geometry::BVH::Node(world, 0.0f, 1.0f);
 }
@@ -159,32 +162,32 @@ Geometry::BVH::Node generate_cornell_box_transformed()
 {
     Geometry::HittableList world;
 
-    auto red    = make_shared<Material::Lambertian>(vec4(.65, .05, .05, 1));
-    auto white  = make_shared<Material::Lambertian>(vec4(.73, .73, .73, 1));
-    auto green  = make_shared<Material::Lambertian>(vec4(.12, .45, .15, 1));
-    auto light  = make_shared<Material::DiffuseLight>(vec4(1, 1, 1, 1));
-    auto glass  = make_shared<Material::Dielectric>(1.4);
-    auto metal  = make_shared<Material::Metal>(vec4(.70, .60, .50, 1), .0);
-    auto orange = make_shared<Material::Metal>(vec4(.80, .40, .20, 1), .2);
+    auto red    = make_scene_shared<Material::Lambertian>(vec4(.65, .05, .05, 1));
+    auto white  = make_scene_shared<Material::Lambertian>(vec4(.73, .73, .73, 1));
+    auto green  = make_scene_shared<Material::Lambertian>(vec4(.12, .45, .15, 1));
+    auto light  = make_scene_shared<Material::DiffuseLight>(vec4(1, 1, 1, 1));
+    auto glass  = make_scene_shared<Material::Dielectric>(1.4);
+    auto metal  = make_scene_shared<Material::Metal>(vec4(.70, .60, .50, 1), .0);
+    auto orange = make_scene_shared<Material::Metal>(vec4(.80, .40, .20, 1), .2);
 
     using Geometry::AxisAlignedRectType;
 
-    world.add(make_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_YZ, green));
-    world.add(make_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555,   0, AxisAlignedRectType::RECT_YZ, red  ));
-    world.add(make_shared<Geometry::AxisAlignedRect>( 50, 505,  50, 505, 554, AxisAlignedRectType::RECT_XZ, light));
-    world.add(make_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555,   0, AxisAlignedRectType::RECT_XZ, white));
-    world.add(make_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_XZ, white));
-    world.add(make_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_XY, white));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_YZ, green));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555,   0, AxisAlignedRectType::RECT_YZ, red  ));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>( 50, 505,  50, 505, 554, AxisAlignedRectType::RECT_XZ, light));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555,   0, AxisAlignedRectType::RECT_XZ, white));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_XZ, white));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_XY, white));
 
-    auto left_box = make_shared<Geometry::Box>(vec3(265, 0, 295), vec3(430, 330, 460), white);
-    auto right_box = make_shared<Geometry::Box>(vec3(130, 0, 65),  vec3(295, 165, 230), metal);
-    auto sphere = make_shared<Geometry::Sphere>(vec3(180, 280, 180), 80, glass);
+    auto left_box = make_scene_shared<Geometry::Box>(vec3(265, 0, 295), vec3(430, 330, 460), white);
+    auto right_box = make_scene_shared<Geometry::Box>(vec3(130, 0, 65),  vec3(295, 165, 230), metal);
+    auto sphere = make_scene_shared<Geometry::Sphere>(vec3(180, 280, 180), 80, glass);
 
     vec4 rotation_left = quaternion_from_axis_angle(vec3(1, 0, 1), degree_to_radian(30));
     vec4 rotation_right = quaternion_from_axis_angle(vec3(1, 1, 0), degree_to_radian(45));
 
-    world.add(make_shared<Geometry::Rotate>(left_box, rotation_left));
-    world.add(make_shared<Geometry::Rotate>(right_box, rotation_right));
+    world.add(make_scene_shared<Geometry::Rotate>(left_box, rotation_left));
+    world.add(make_scene_shared<Geometry::Rotate>(right_box, rotation_right));
     world.add(sphere);
 
     const vec3 cone_coords[4] = {
@@ -194,10 +197,10 @@ Geometry::BVH::Node generate_cornell_box_transformed()
         vec3(450, 200,  50),
     };
 
-    world.add(make_shared<Geometry::Triangle>(cone_coords[0], cone_coords[2], cone_coords[3], orange));
-    world.add(make_shared<Geometry::Triangle>(cone_coords[1], cone_coords[3], cone_coords[2], orange));
-    world.add(make_shared<Geometry::Triangle>(cone_coords[0], cone_coords[3], cone_coords[1], orange));
-    world.add(make_shared<Geometry::Triangle>(cone_coords[0], cone_coords[1], cone_coords[2], orange));
+    world.add(make_scene_shared<Geometry::Triangle>(cone_coords[0], cone_coords[2], cone_coords[3], orange));
+    world.add(make_scene_shared<Geometry::Triangle>(cone_coords[1], cone_coords[3], cone_coords[2], orange));
+    world.add(make_scene_shared<Geometry::Triangle>(cone_coords[0], cone_coords[3], cone_coords[1], orange));
+    world.add(make_scene_shared<Geometry::Triangle>(cone_coords[0], cone_coords[1], cone_coords[2], orange));
 
     return Geometry::BVH::Node(world, 0.0f, 1.0f);
 }
@@ -206,23 +209,23 @@ Geometry::BVH::Node generate_cornell_box_mesh()
 {
     Geometry::HittableList world;
 
-    auto red    = make_shared<Material::Lambertian>(vec4(.65, .05, .05, 1));
-    auto white  = make_shared<Material::Lambertian>(vec4(.73, .73, .73, 1));
-    auto green  = make_shared<Material::Lambertian>(vec4(.12, .45, .15, 1));
-    auto light  = make_shared<Material::DiffuseLight>(vec4(1, 1, 1, 1));
-    auto glass  = make_shared<Material::Dielectric>(1.4);
-    auto metal  = make_shared<Material::Metal>(vec4(.70, .60, .50, 1), .0);
+    auto red    = make_scene_shared<Material::Lambertian>(vec4(.65, .05, .05, 1));
+    auto white  = make_scene_shared<Material::Lambertian>(vec4(.73, .73, .73, 1));
+    auto green  = make_scene_shared<Material::Lambertian>(vec4(.12, .45, .15, 1));
+    auto light  = make_scene_shared<Material::DiffuseLight>(vec4(1, 1, 1, 1));
+    auto glass  = make_scene_shared<Material::Dielectric>(1.4);
+    auto metal  = make_scene_shared<Material::Metal>(vec4(.70, .60, .50, 1), .0);
 
     using Geometry::AxisAlignedRectType;
 
-    world.add(make_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_YZ, green));
-    world.add(make_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555,   0, AxisAlignedRectType::RECT_YZ, red  ));
-    world.add(make_shared<Geometry::AxisAlignedRect>( 50, 505,  50, 505, 554, AxisAlignedRectType::RECT_XZ, light));
-    world.add(make_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555,   0, AxisAlignedRectType::RECT_XZ, white));
-    world.add(make_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_XZ, white));
-    world.add(make_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_XY, white));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_YZ, green));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555,   0, AxisAlignedRectType::RECT_YZ, red  ));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>( 50, 505,  50, 505, 554, AxisAlignedRectType::RECT_XZ, light));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555,   0, AxisAlignedRectType::RECT_XZ, white));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_XZ, white));
+    world.add(make_scene_shared<Geometry::AxisAlignedRect>(  0, 555,   0, 555, 555, AxisAlignedRectType::RECT_XY, white));
 
-    auto mesh = std::make_shared<Geometry::BVH::Node>(
+    auto mesh = make_scene_shared<Geometry::BVH::Node>(
         Utility::load_mesh("assets/mesh/spot.obj", metal, vec3(300, 300, 300), vec3(275, 200, 275)));
 
     // vec4 rotation = quaternion_from_axis_angle(vec3(0, 1, 0), degree_to_radian(45));
@@ -232,5 +235,150 @@ Geometry::BVH::Node generate_cornell_box_mesh()
     return Geometry::BVH::Node(world, 0.0f, 1.0f);
 }
 
+#define SCENE_NUM 7
+// Generator seed scenes are built with, the default of a fresh std::mt19937
+// so the layout is that of a program that has not drawn yet
+#define SCENE_SEED 5489u
+
+struct CameraKey
+{
+    int frame;
+    vec3 eye, at, up;
+    float fov;
+};
+
+struct TransformKey
+{
+    int frame;
+    vec3 axis;
+    float degrees;
+    vec3 offset;
+};
+
+/**
+ * Instance placed by a rotation about its center followed by a translation,
+ * both changed in place between frames
+ */
+struct AnimatedInstance
+{
+    shared_ptr<Geometry::Rotate> rotate;
+    shared_ptr<Geometry::Translate> translate;
+    TransformKey base;                  // placement where there are no keys
+    std::vector<TransformKey> keys;     // in frame order
+};
+
+/**
+ * Key frames of a scene file, values are interpolated linearly between
+ * keys and hold before the first and after the last one
+ */
+struct Animation
+{
+    int frames;
+    std::vector<CameraKey> camera;
+    std::map<std::string, AnimatedInstance> instances;
+    Geometry::HittableList objects;     // top level objects the world BVH is built over
+};
+
+/**
+ * World and camera placement of a built-in scene
+ */
+struct SceneSetup
+{
+    shared_ptr<Utility::Arena> arena;   // the scene's objects, first so it goes away last
+    Geometry::BVH::Node world;
+    vec3 eye, at, up;
+    float fov;
+    float aspect_ratio;     // left as is unless the scene needs a certain one
+    shared_ptr<Animation> animation;    // scene files with key frames only
+};
+
+/**
+ * Release the scene setup held so far and start a new arena for the next one
+ */
+void reset_scene(SceneSetup & setup)
+{
+    setup.world = Geometry::BVH::Node();
+    setup.animation = nullptr;
+    setup.arena = make_shared<Utility::Arena>();
+}
+
+/**
+ * Memory of every subsystem once a scene is built, peaks include what loading took
+ */
+void print_scene_memory(const SceneSetup & setup)
+{
+    Utility::memory_stats().print();
+    printf("       scene arena: %zu objects in %.1f KB, %.1f KB reserved\n", setup.arena->objects(),
+        setup.arena->used() / 1024.0f, setup.arena->reserved() / 1024.0f);
+}
+
+/**
+ * Build scene number scene_idx, returns false if there is no such scene
+ */
+bool setup_scene(int scene_idx, SceneSetup & setup)
+{
+    if (scene_idx < 0 || scene_idx >= SCENE_NUM) return false;
+    reset_scene(setup);
+    Utility::ArenaScope arena_scope(setup.arena);
+    switch (scene_idx)
+    {
+        case 0:
+            setup.world = generate_random_scene();
+            setup.eye = vec3(13.0f, 2.0f, 3.0f);
+            setup.at  = vec3( 0.0f, 0.0f, 0.0f);
+            setup.up  = vec3( 0.0f, 1.0f, 0.0f);
+            setup.fov = 20.0f;
+            break;
+        case 1:
+            setup.world = generate_simple_scene();
+            setup.eye = vec3( 0.0f, 4.0f, 6.0f);
+            setup.at  = vec3( 0.0f, 0.0f, 0.0f);
+            setup.up  = vec3( 0.0f, 1.0f, 0.0f);
+            setup.fov = 90.0f;
+            break;
+        case 2:
+            setup.world = generate_two_perlin_spheres();
+            setup.eye = vec3(13.0f, 2.0f, 3.0f);
+            setup.at  = vec3( 0.0f, 0.0f, 0.0f);
+            setup.up  = vec3( 0.0f, 1.0f, 0.0f);
+            setup.fov = 20.0;
+            break;
+        case 3:
+            setup.world = generate_earth();
+            setup.eye = vec3(13.0f, 2.0f, 3.0f);
+            setup.at  = vec3( 0.0f, 0.0f, 0.0f);
+            setup.up  = vec3( 0.0f, 1.0f, 0.0f);
+            setup.fov = 20.0;
+            break;
+        case 4:
+            setup.world = generate_cornell_box();
+            setup.eye = vec3(278.0f, 278.0f, -750.0f);
+            setup.at  = vec3(278.0f, 278.0f,    0.0f);
+            setup.up  = vec3(  0.0f,  1.0f,     0.0f);
+            setup.fov = 40.0;
+            setup.aspect_ratio = 1.0f;
+            break;
+        case 5:
+            setup.world = generate_cornell_box_transformed();
+            setup.eye = vec3(278.0f, 278.0f, -750.0f);
+            setup.at  = vec3(278.0f, 278.0f,    0.0f);
+            setup.up  = vec3(  0.0f,  1.0f,     0.0f);
+            setup.fov = 40.0;
+            setup.aspect_ratio = 1.0f;
+            break;
+        case 6:
+            setup.world = generate_cornell_box_mesh();
+            setup.eye = vec3(278.0f, 278.0f, -750.0f);
+            setup.at  = vec3(278.0f, 278.0f,    0.0f);
+            setup.up  = vec3(  0.0f,  1.0f,     0.0f);
+            setup.fov = 40.0;
+            setup.aspect_ratio = 1.0f;
+            break;
+        default:
+            return false;
+    }
+    print_scene_memory(setup);
+    return true;
+}
 
 #endif
\ No newline at end of file
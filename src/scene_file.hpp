@@ -0,0 +1,617 @@
+#ifndef __SCENE_FILE_HPP__
+#define __SCENE_FILE_HPP__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "global.hpp"
+#include "geometry.hpp"
+#include "rect.hpp"
+#include "material.hpp"
+#include "mesh.hpp"
+#include "scene.hpp"
+#include "trace.hpp"
+
+// Scene description files, one statement per line, '#' starts a comment
+//
+//   camera <eye x y z> <at x y z> <up x y z> <fov> [aspect ratio]
+//   texture <name> checker <r g b> <r g b> [cells]
+//   texture <name> noise <scale>
+//   texture <name> image <file>
+//   material <name> lambertian <r g b> | <texture>
+//   material <name> metal <r g b> <fuzz>
+//   material <name> dielectric <index of refraction>
+//   material <name> light <r g b>
+//   sphere <center x y z> <radius> <material>
+//   moving_sphere <center0 x y z> <center1 x y z> <time0> <time1> <radius> <material>
+//   rect <xy|xz|yz> <a0> <a1> <b0> <b1> <k> <material>
+//   box <min x y z> <max x y z> <material>
+//   triangle <p0 x y z> <p1 x y z> <p2 x y z> <material>
+//   mesh <name> <obj file> <material> <scale x y z> <offset x y z>
+//   group <name> ... end
+//   instance <name> [rotate <axis x y z> <degrees>] [translate <x y z>]
+//   instance <name> as <label> [rotate <axis x y z> <degrees>] [translate <x y z>]
+//   frames <count>
+//   key <frame> camera <eye x y z> <at x y z> <up x y z> <fov>
+//   key <frame> <label> [rotate <axis x y z> <degrees>] [translate <x y z>]
+//
+// Primitives go into the world unless they are between group and end, meshes
+// and groups are only placed by instance. Textures and materials may be
+// defined anywhere in the file; image textures and meshes load in parallel.
+// Labelled instances are rotated about their center, then translated, and
+// can be moved by key frames of an animation of the given number of frames;
+// transforms a key leaves out are those of the instance statement.
+
+namespace Scene
+{
+
+class SceneFileParser
+{
+private:
+    struct Statement
+    {
+        int line;
+        std::vector<char *> tokens;
+    };
+
+    const char * m_filename;
+    std::vector<char> m_buffer;
+    std::vector<Statement> m_statements;
+    std::map<std::string, shared_ptr<Utility::Texture> > m_textures;
+    std::map<std::string, shared_ptr<Material::Material> > m_materials;
+    std::map<std::string, shared_ptr<Geometry::Hittable> > m_objects;
+    shared_ptr<Animation> m_animation;
+
+    // Cursor of the statement being read
+    const Statement * m_statement;
+    size_t m_token;
+
+    bool error(const char * message)
+    {
+        printf("[ERROR] [%s:%d] %s\n", m_filename, m_statement ? m_statement->line : 0, message);
+        return false;
+    }
+
+    bool has_token() const { return m_token < m_statement->tokens.size(); }
+    const char * peek() const { return has_token() ? m_statement->tokens[m_token] : ""; }
+
+    bool next_name(std::string & value)
+    {
+        if (!has_token()) return error("Missing argument");
+        value = m_statement->tokens[m_token++];
+        return true;
+    }
+
+    bool next_float(float & value)
+    {
+        if (!has_token()) return error("Missing number");
+        char * end;
+        value = strtof(m_statement->tokens[m_token], &end);
+        if (*end != '\0') return error("Expected a number");
+        m_token++;
+        return true;
+    }
+
+    bool next_int(int & value)
+    {
+        float f;
+        if (!next_float(f)) return false;
+        value = (int)f;
+        return true;
+    }
+
+    bool next_vec3(vec3 & value)
+    {
+        return next_float(value.x) && next_float(value.y) && next_float(value.z);
+    }
+
+    bool next_color(vec4 & value)
+    {
+        value.a = 1.0f;
+        return next_float(value.r) && next_float(value.g) && next_float(value.b);
+    }
+
+    bool peek_number() const
+    {
+        char * end;
+        strtof(peek(), &end);
+        return has_token() && *end == '\0';
+    }
+
+    bool next_material(shared_ptr<Material::Material> & material)
+    {
+        std::string name;
+        if (!next_name(name)) return false;
+        auto it = m_materials.find(name);
+        if (it == m_materials.end()) return error("Unknown material");
+        material = it->second;
+        return true;
+    }
+
+    static bool file_exists(const std::string & filename)
+    {
+        FILE * file = fopen(filename.c_str(), "rb");
+        if (file) fclose(file);
+        return file != nullptr;
+    }
+
+    bool finish()
+    {
+        return has_token() ? error("Unexpected extra arguments") : true;
+    }
+
+    void begin(const Statement & statement)
+    {
+        m_statement = &statement;
+        m_token = 1;
+    }
+
+    bool is(const Statement & statement, const char * keyword) const
+    {
+        return strcmp(statement.tokens[0], keyword) == 0;
+    }
+
+    /**
+     * Split the file in place into statements of whitespace separated tokens
+     */
+    bool tokenize()
+    {
+        FILE * file = fopen(m_filename, "rb");
+        if (!file)
+        {
+            printf("[ERROR] Failed to open scene [%s]\n", m_filename);
+            return false;
+        }
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        m_buffer.resize(size + 1);
+        size_t read = fread(m_buffer.data(), 1, size, file);
+        fclose(file);
+        m_buffer[read] = '\0';
+
+        char * p = m_buffer.data();
+        int line = 1;
+        Statement statement;
+        statement.line = line;
+        while (true)
+        {
+            while (*p == ' ' || *p == '\t' || *p == '\r') *p++ = '\0';
+            if (*p == '#')
+            {
+                while (*p && *p != '\n') *p++ = '\0';
+            }
+            if (*p == '\n' || *p == '\0')
+            {
+                if (!statement.tokens.empty()) m_statements.push_back(statement);
+                if (*p == '\0') break;
+                *p++ = '\0';
+                statement.tokens.clear();
+                statement.line = ++line;
+                continue;
+            }
+            statement.tokens.push_back(p);
+            while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '#') p++;
+        }
+        return true;
+    }
+
+    /**
+     * Run job(i) for i in [0, count) on all hardware threads
+     */
+    template <typename Job>
+    static void parallel_for(size_t count, Job job)
+    {
+        std::atomic<size_t> next(0);
+        size_t threads = MIN((size_t)MAX(std::thread::hardware_concurrency(), 1u), count);
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < threads; t++)
+        {
+            workers.push_back(std::thread([&]() { for (size_t i; (i = next++) < count; ) job(i); }));
+        }
+        for (size_t i; (i = next++) < count; ) job(i);
+        for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+    }
+
+    bool parse_textures()
+    {
+        // Image files are decoded in parallel, the procedural textures in file
+        // order since Perlin draws from the random generator
+        std::vector<std::pair<std::string, std::string> > images;
+        for (size_t s = 0; s < m_statements.size(); s++)
+        {
+            if (!is(m_statements[s], "texture")) continue;
+            begin(m_statements[s]);
+            std::string name, type;
+            if (!next_name(name) || !next_name(type)) return false;
+            if (m_textures.count(name)) return error("Texture defined twice");
+            if (type == "checker")
+            {
+                vec4 even, odd;
+                int cells = 10;
+                if (!next_color(even) || !next_color(odd)) return false;
+                if (has_token() && !next_int(cells)) return false;
+                m_textures[name] = make_scene_shared<Utility::CheckerTexture>(even, odd, cells);
+            }
+            else if (type == "noise")
+            {
+                float scale;
+                if (!next_float(scale)) return false;
+                m_textures[name] = make_scene_shared<Utility::NoiseTexturePos>(scale);
+            }
+            else if (type == "image")
+            {
+                std::string filename;
+                if (!next_name(filename)) return false;
+                // Loaders exit on missing files, a server must get an error instead
+                if (!file_exists(filename)) return error("Image file not found");
+                images.push_back(std::make_pair(name, filename));
+                m_textures[name] = nullptr;
+            }
+            else return error("Unknown texture type");
+            if (!finish()) return false;
+        }
+
+        std::vector<shared_ptr<Utility::Texture> > loaded(images.size());
+        parallel_for(images.size(), [&](size_t i) {
+            loaded[i] = make_scene_shared<Utility::ImageTexture>(images[i].second.c_str());
+        });
+        for (size_t i = 0; i < images.size(); i++) m_textures[images[i].first] = loaded[i];
+        return true;
+    }
+
+    bool parse_materials()
+    {
+        for (size_t s = 0; s < m_statements.size(); s++)
+        {
+            if (!is(m_statements[s], "material")) continue;
+            begin(m_statements[s]);
+            std::string name, type;
+            if (!next_name(name) || !next_name(type)) return false;
+            if (m_materials.count(name)) return error("Material defined twice");
+            vec4 color;
+            if (type == "lambertian" && peek_number())
+            {
+                if (!next_color(color)) return false;
+                m_materials[name] = make_scene_shared<Material::Lambertian>(color);
+            }
+            else if (type == "lambertian")
+            {
+                std::string texture;
+                if (!next_name(texture)) return false;
+                auto it = m_textures.find(texture);
+                if (it == m_textures.end()) return error("Unknown texture");
+                m_materials[name] = make_scene_shared<Material::Lambertian>(it->second);
+            }
+            else if (type == "metal")
+            {
+                float fuzz;
+                if (!next_color(color) || !next_float(fuzz)) return false;
+                m_materials[name] = make_scene_shared<Material::Metal>(color, fuzz);
+            }
+            else if (type == "dielectric")
+            {
+                float ir;
+                if (!next_float(ir)) return false;
+                m_materials[name] = make_scene_shared<Material::Dielectric>(ir);
+            }
+            else if (type == "light")
+            {
+                if (!next_color(color)) return false;
+                m_materials[name] = make_scene_shared<Material::DiffuseLight>(color);
+            }
+            else return error("Unknown material type");
+            if (!finish()) return false;
+        }
+        return true;
+    }
+
+    bool parse_meshes()
+    {
+        struct MeshJob
+        {
+            std::string name;
+            std::string filename;
+            shared_ptr<Material::Material> material;
+            vec3 scale, offset;
+        };
+        std::vector<MeshJob> jobs;
+        for (size_t s = 0; s < m_statements.size(); s++)
+        {
+            if (!is(m_statements[s], "mesh")) continue;
+            begin(m_statements[s]);
+            MeshJob job;
+            if (!next_name(job.name) || !next_name(job.filename) || !next_material(job.material)
+             || !next_vec3(job.scale) || !next_vec3(job.offset) || !finish()) return false;
+            if (!file_exists(job.filename)) return error("Mesh file not found");
+            if (m_objects.count(job.name)) return error("Object defined twice");
+            m_objects[job.name] = nullptr;
+            jobs.push_back(job);
+        }
+
+        // Each mesh is read and gets its BVH on a thread of its own
+        std::vector<shared_ptr<Geometry::Hittable> > loaded(jobs.size());
+        parallel_for(jobs.size(), [&](size_t i) {
+            loaded[i] = make_scene_shared<Geometry::BVH::Node>(Utility::load_mesh(
+                jobs[i].filename.c_str(), jobs[i].material, jobs[i].scale, jobs[i].offset));
+        });
+        for (size_t i = 0; i < jobs.size(); i++) m_objects[jobs[i].name] = loaded[i];
+        return true;
+    }
+
+    /**
+     * Optional rotate and translate of an instance or key, in that order
+     */
+    bool parse_transform(TransformKey & key)
+    {
+        if (strcmp(peek(), "rotate") == 0)
+        {
+            m_token++;
+            if (!next_vec3(key.axis) || !next_float(key.degrees)) return false;
+        }
+        if (strcmp(peek(), "translate") == 0)
+        {
+            m_token++;
+            if (!next_vec3(key.offset)) return false;
+        }
+        return true;
+    }
+
+    bool parse_animated_instance(const std::string & label, shared_ptr<Geometry::Hittable> & object)
+    {
+        if (!m_animation) m_animation = make_shared<Animation>();
+        if (m_animation->instances.count(label)) return error("Instance label used twice");
+        AnimatedInstance instance;
+        TransformKey & base = instance.base;
+        base.frame = 0;
+        base.axis = vec3(0.0f, 1.0f, 0.0f);
+        base.degrees = 0.0f;
+        base.offset = vec3(0.0f);
+        if (!parse_transform(base)) return false;
+        instance.rotate = make_scene_shared<Geometry::Rotate>(object,
+            quaternion_from_axis_angle(base.axis, degree_to_radian(base.degrees)));
+        instance.translate = make_scene_shared<Geometry::Translate>(instance.rotate, base.offset);
+        m_animation->instances[label] = instance;
+        object = instance.translate;
+        return true;
+    }
+
+    bool parse_primitive(const Statement & statement, shared_ptr<Geometry::Hittable> & object)
+    {
+        shared_ptr<Material::Material> material;
+        if (is(statement, "sphere"))
+        {
+            vec3 center;
+            float radius;
+            if (!next_vec3(center) || !next_float(radius) || !next_material(material)) return false;
+            object = make_scene_shared<Geometry::Sphere>(center, radius, material);
+        }
+        else if (is(statement, "moving_sphere"))
+        {
+            vec3 center0, center1;
+            float time0, time1, radius;
+            if (!next_vec3(center0) || !next_vec3(center1) || !next_float(time0) || !next_float(time1)
+             || !next_float(radius) || !next_material(material)) return false;
+            object = make_scene_shared<Geometry::MovingSphere>(center0, center1, time0, time1, radius, material);
+        }
+        else if (is(statement, "rect"))
+        {
+            std::string plane;
+            float a0, a1, b0, b1, k;
+            if (!next_name(plane) || !next_float(a0) || !next_float(a1) || !next_float(b0) || !next_float(b1)
+             || !next_float(k) || !next_material(material)) return false;
+            Geometry::AxisAlignedRectType type;
+            if (plane == "xy") type = Geometry::AxisAlignedRectType::RECT_XY;
+            else if (plane == "xz") type = Geometry::AxisAlignedRectType::RECT_XZ;
+            else if (plane == "yz") type = Geometry::AxisAlignedRectType::RECT_YZ;
+            else return error("Rect plane must be xy, xz or yz");
+            object = make_scene_shared<Geometry::AxisAlignedRect>(a0, a1, b0, b1, k, type, material);
+        }
+        else if (is(statement, "box"))
+        {
+            vec3 min, max;
+            if (!next_vec3(min) || !next_vec3(max) || !next_material(material)) return false;
+            object = make_scene_shared<Geometry::Box>(min, max, material);
+        }
+        else if (is(statement, "triangle"))
+        {
+            vec3 p0, p1, p2;
+            if (!next_vec3(p0) || !next_vec3(p1) || !next_vec3(p2) || !next_material(material)) return false;
+            object = make_scene_shared<Geometry::Triangle>(p0, p1, p2, material);
+        }
+        else if (is(statement, "instance"))
+        {
+            std::string name;
+            if (!next_name(name)) return false;
+            auto it = m_objects.find(name);
+            if (it == m_objects.end() || !it->second) return error("Unknown object, define it before its instances");
+            object = it->second;
+            if (strcmp(peek(), "as") == 0)
+            {
+                std::string label;
+                m_token++;
+                if (!next_name(label) || !parse_animated_instance(label, object)) return false;
+            }
+            else while (has_token())
+            {
+                std::string transform;
+                next_name(transform);
+                if (transform == "rotate")
+                {
+                    vec3 axis;
+                    float degrees;
+                    if (!next_vec3(axis) || !next_float(degrees)) return false;
+                    object = make_scene_shared<Geometry::Rotate>(object, quaternion_from_axis_angle(axis, degree_to_radian(degrees)));
+                }
+                else if (transform == "translate")
+                {
+                    vec3 offset;
+                    if (!next_vec3(offset)) return false;
+                    object = make_scene_shared<Geometry::Translate>(object, offset);
+                }
+                else return error("Unknown instance transform");
+            }
+        }
+        else return error("Unknown statement");
+        return finish();
+    }
+
+    bool parse_world(SceneSetup & setup)
+    {
+        Geometry::HittableList world;
+        Geometry::HittableList group;
+        std::string group_name;
+        bool has_camera = false;
+        for (size_t s = 0; s < m_statements.size(); s++)
+        {
+            const Statement & statement = m_statements[s];
+            begin(statement);
+            if (is(statement, "texture") || is(statement, "material") || is(statement, "mesh")
+             || is(statement, "frames") || is(statement, "key")) continue;
+
+            if (is(statement, "camera"))
+            {
+                if (!next_vec3(setup.eye) || !next_vec3(setup.at) || !next_vec3(setup.up) || !next_float(setup.fov)) return false;
+                if (has_token() && !next_float(setup.aspect_ratio)) return false;
+                if (!finish()) return false;
+                has_camera = true;
+            }
+            else if (is(statement, "group"))
+            {
+                if (!group_name.empty()) return error("Groups can't be nested");
+                if (!next_name(group_name) || !finish()) return false;
+                if (m_objects.count(group_name)) return error("Object defined twice");
+            }
+            else if (is(statement, "end"))
+            {
+                if (group_name.empty()) return error("End without group");
+                if (!finish()) return false;
+                if (group.objects().empty()) return error("Empty group");
+                // A single object is used as is, more get a BVH of their own
+                m_objects[group_name] = group.objects().size() == 1 ? group.objects()[0]
+                    : make_scene_shared<Geometry::BVH::Node>(group, 0.0f, 1.0f);
+                group.clear();
+                group_name.clear();
+            }
+            else
+            {
+                shared_ptr<Geometry::Hittable> object;
+                if (!parse_primitive(statement, object)) return false;
+                if (group_name.empty()) world.add(object);
+                else group.add(object);
+            }
+        }
+
+        m_statement = nullptr;
+        if (!group_name.empty()) return error("Group without end");
+        if (!has_camera) return error("No camera");
+        if (world.objects().empty()) return error("Nothing in the world");
+        setup.world = Geometry::BVH::Node(world, 0.0f, 1.0f);
+        // Kept for rebuilding the BVH once key frames moved the instances
+        if (!m_animation) m_animation = make_shared<Animation>();
+        m_animation->objects = world;
+        return true;
+    }
+
+    static bool key_before(const TransformKey & a, const TransformKey & b) { return a.frame < b.frame; }
+    static bool camera_key_before(const CameraKey & a, const CameraKey & b) { return a.frame < b.frame; }
+
+    /**
+     * Frame count and key frames, read once all instance labels are known
+     */
+    bool parse_animation(SceneSetup & setup)
+    {
+        int frames = 0;
+        for (size_t s = 0; s < m_statements.size(); s++)
+        {
+            if (!is(m_statements[s], "frames")) continue;
+            begin(m_statements[s]);
+            if (frames > 0) return error("Frame count given twice");
+            if (!next_int(frames) || !finish()) return false;
+            if (frames < 1) return error("Frame count must be positive");
+        }
+
+        for (size_t s = 0; s < m_statements.size(); s++)
+        {
+            if (!is(m_statements[s], "key")) continue;
+            begin(m_statements[s]);
+            int frame;
+            std::string label;
+            if (!next_int(frame) || !next_name(label)) return false;
+            if (frames == 0) return error("Key frames need a frames statement");
+            if (frame < 0 || frame >= frames) return error("Key frame out of range");
+            if (label == "camera")
+            {
+                CameraKey key;
+                key.frame = frame;
+                if (!next_vec3(key.eye) || !next_vec3(key.at) || !next_vec3(key.up) || !next_float(key.fov)) return false;
+                m_animation->camera.push_back(key);
+            }
+            else
+            {
+                auto it = m_animation->instances.find(label);
+                if (it == m_animation->instances.end()) return error("Unknown instance label");
+                TransformKey key = it->second.base;
+                key.frame = frame;
+                if (!parse_transform(key)) return false;
+                it->second.keys.push_back(key);
+            }
+            if (!finish()) return false;
+        }
+        m_statement = nullptr;
+
+        // Keys may be given in any order
+        std::stable_sort(m_animation->camera.begin(), m_animation->camera.end(), camera_key_before);
+        for (auto it = m_animation->instances.begin(); it != m_animation->instances.end(); ++it)
+        {
+            std::stable_sort(it->second.keys.begin(), it->second.keys.end(), key_before);
+        }
+        m_animation->frames = frames;
+        setup.animation = frames > 0 ? m_animation : nullptr;
+        return true;
+    }
+
+public:
+    SceneFileParser(const char * filename):
+        m_filename(filename),
+        m_statement(nullptr),
+        m_token(0) {}
+
+    bool parse(SceneSetup & setup)
+    {
+        return tokenize() && parse_textures() && parse_materials() && parse_meshes() && parse_world(setup)
+            && parse_animation(setup);
+    }
+
+    size_t statements() const { return m_statements.size(); }
+};
+
+/**
+ * Build the world and camera described by a scene file, returns false and
+ * prints where on errors
+ */
+bool load_scene_file(const char * filename, SceneSetup & setup)
+{
+    TRACE_SCOPE("scene load");
+    double start_timestamp = wall_seconds();
+    reset_scene(setup);
+    Utility::ArenaScope arena_scope(setup.arena);
+    SceneFileParser parser(filename);
+    if (!parser.parse(setup)) return false;
+
+    char total_time[DURATION_STR_LENGTH];
+    get_duration_str((float)(wall_seconds() - start_timestamp), total_time);
+    printf("[INFO] Scene [%s] loaded, %zu statements in %s\n", filename, parser.statements(), total_time);
+    print_scene_memory(setup);
+    return true;
+}
+
+} // namespace Scene
+
+#endif
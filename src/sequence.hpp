@@ -0,0 +1,224 @@
+#ifndef __SEQUENCE_HPP__
+#define __SEQUENCE_HPP__
+
+#include <stdio.h>
+#include <vector>
+#include "global.hpp"
+#include "image.hpp"
+#include "camera.hpp"
+#include "scene.hpp"
+#include "render.hpp"
+#include "trace.hpp"
+
+// Rebuild the world BVH once refitting made the summed surface area of its
+// nodes this much larger than right after the last build
+#define SEQUENCE_REBUILD_RATIO 1.5f
+#define SEQUENCE_NAME_LENGTH 256
+
+namespace Scene
+{
+
+/**
+ * Renders the key framed animation of a scene file to numbered frames.
+ * The scene stays loaded across frames: instances are moved in place and
+ * the world BVH refit to their new bounds, frames where neither the camera
+ * nor any instance moved are copied from the one before.
+ */
+class SequenceRenderer
+{
+private:
+    SceneSetup & m_setup;
+    Animation & m_animation;
+    float m_built_area;
+    int m_refits;
+    int m_rebuilds;
+    int m_reused;
+
+    /**
+     * Keys around frame and how far between them it is
+     */
+    template <typename Key>
+    static float find_keys(const std::vector<Key> & keys, int frame, const Key * & key0, const Key * & key1)
+    {
+        key0 = key1 = &keys[0];
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            if (keys[i].frame <= frame) key0 = key1 = &keys[i];
+            else { key1 = &keys[i]; break; }
+        }
+        if (key0 == key1 || frame <= key0->frame) return 0.0f;
+        return (float)(frame - key0->frame) / (key1->frame - key0->frame);
+    }
+
+    CameraKey camera_at(int frame) const
+    {
+        CameraKey camera = { frame, m_setup.eye, m_setup.at, m_setup.up, m_setup.fov };
+        if (m_animation.camera.empty()) return camera;
+        const CameraKey * key0;
+        const CameraKey * key1;
+        float s = find_keys(m_animation.camera, frame, key0, key1);
+        camera.eye = LERP(key0->eye, key1->eye, s);
+        camera.at = LERP(key0->at, key1->at, s);
+        camera.up = LERP(key0->up, key1->up, s);
+        camera.fov = LERP(key0->fov, key1->fov, s);
+        return camera;
+    }
+
+    /**
+     * Axis and angle are interpolated on their own, so keys about the
+     * same axis may turn by more than half a revolution
+     */
+    static TransformKey transform_at(const AnimatedInstance & instance, int frame)
+    {
+        if (instance.keys.empty()) return instance.base;
+        const TransformKey * key0;
+        const TransformKey * key1;
+        float s = find_keys(instance.keys, frame, key0, key1);
+        TransformKey transform;
+        transform.frame = frame;
+        transform.axis = LERP(key0->axis, key1->axis, s);
+        transform.degrees = LERP(key0->degrees, key1->degrees, s);
+        transform.offset = LERP(key0->offset, key1->offset, s);
+        return transform;
+    }
+
+    static bool same_camera(const CameraKey & a, const CameraKey & b)
+    {
+        return a.eye == b.eye && a.at == b.at && a.up == b.up && a.fov == b.fov;
+    }
+
+    static bool same_transform(const TransformKey & a, const TransformKey & b)
+    {
+        return a.axis == b.axis && a.degrees == b.degrees && a.offset == b.offset;
+    }
+
+    /**
+     * Move the instances to their place in frame and bring the BVH up to
+     * date, returns false if nothing moved since the last frame
+     */
+    bool update(int frame, std::vector<TransformKey> & transforms)
+    {
+        bool moved = false;
+        size_t i = 0;
+        for (auto it = m_animation.instances.begin(); it != m_animation.instances.end(); ++it, i++)
+        {
+            TransformKey transform = transform_at(it->second, frame);
+            if (same_transform(transform, transforms[i])) continue;
+            transforms[i] = transform;
+            it->second.rotate->set_rotation(quaternion_from_axis_angle(transform.axis, degree_to_radian(transform.degrees)));
+            it->second.translate->set_offset(transform.offset);
+            moved = true;
+        }
+        if (!moved) return false;
+
+        TRACE_SCOPE("bvh refit");
+        float area = m_setup.world.refit();
+        if (area > SEQUENCE_REBUILD_RATIO * m_built_area)
+        {
+            // The arena keeps the nodes of earlier builds until the scene goes
+            Utility::ArenaScope arena_scope(m_setup.arena);
+            m_setup.world = Geometry::BVH::Node(m_animation.objects, 0.0f, 1.0f);
+            m_built_area = m_setup.world.refit();
+            m_rebuilds++;
+        }
+        else
+        {
+            m_refits++;
+        }
+        return true;
+    }
+
+    /**
+     * Render a frame the way the tiled renderer does without checkpoints
+     */
+    void render(const Camera & camera, int samples_per_pixel, int max_depth, Utility::Image & image)
+    {
+        int width = image.width();
+        int height = image.height();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int j = 0; j < height; j++)
+        for (int i = 0; i < width; i++)
+        {
+            vec4 pixel_color(0.0f);
+            seed_pixel(0, j * width + i, 0);
+            trace_pixel(camera, m_setup.world, i, j, width, height, samples_per_pixel, max_depth, true,
+                [&](const vec4 & color) { pixel_color += color; });
+            pixel_color *= 1.0f / samples_per_pixel;
+            image(i, j, 0) = pixel_color.r;
+            image(i, j, 1) = pixel_color.g;
+            image(i, j, 2) = pixel_color.b;
+        }
+    }
+
+public:
+    SequenceRenderer(SceneSetup & setup):
+        m_setup(setup),
+        m_animation(*setup.animation),
+        m_refits(0),
+        m_rebuilds(0),
+        m_reused(0)
+    {
+        m_built_area = m_setup.world.refit();
+    }
+
+    /**
+     * Render every frame to <prefix><frame number>.png
+     */
+    void render(int width, int height, int samples_per_pixel, int max_depth,
+                float aperture, float focal_length, const char * prefix)
+    {
+        double start_timestamp = wall_seconds();
+        Utility::Image image(width, height, 3);
+        float aspect_ratio = (float)width / height;
+
+        // Instances start where the scene file put them
+        std::vector<TransformKey> transforms;
+        for (auto it = m_animation.instances.begin(); it != m_animation.instances.end(); ++it)
+        {
+            transforms.push_back(it->second.base);
+        }
+        CameraKey last_camera;
+
+        for (int frame = 0; frame < m_animation.frames; frame++)
+        {
+            TRACE_SCOPE_ARG("frame", frame);
+            double frame_timestamp = wall_seconds();
+            bool moved = update(frame, transforms);
+            CameraKey view = camera_at(frame);
+            bool reuse = frame > 0 && !moved && same_camera(view, last_camera);
+            last_camera = view;
+
+            if (reuse)
+            {
+                m_reused++;
+            }
+            else
+            {
+                Camera camera(view.eye, view.at, view.up, view.fov, aspect_ratio, aperture, focal_length, 1.0f);
+                camera.set_image_height(height);
+                render(camera, samples_per_pixel, max_depth, image);
+            }
+
+            char filename[SEQUENCE_NAME_LENGTH];
+            snprintf(filename, sizeof(filename), "%s%04d.png", prefix, frame);
+            image.save(filename);
+
+            char frame_time[DURATION_STR_LENGTH];
+            get_duration_str((float)(wall_seconds() - frame_timestamp), frame_time);
+            printf("[INFO] Frame %4d / %d [%s] %s in %s\n", frame + 1, m_animation.frames, filename,
+                reuse ? "reused" : "rendered", frame_time);
+            fflush(stdout);
+        }
+
+        char total_time[DURATION_STR_LENGTH];
+        get_duration_str((float)(wall_seconds() - start_timestamp), total_time);
+        printf("[INFO] Sequence done in %s: %d frames, %d reused, %d BVH refits, %d rebuilds\n", total_time,
+            m_animation.frames, m_reused, m_refits, m_rebuilds);
+    }
+};
+
+} // namespace Scene
+
+#endif
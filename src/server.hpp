@@ -0,0 +1,262 @@
+#ifndef __SERVER_HPP__
+#define __SERVER_HPP__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <memory>
+#include <string>
+#include "global.hpp"
+#include "image.hpp"
+#include "camera.hpp"
+#include "scene.hpp"
+#include "scene_file.hpp"
+#include "render.hpp"
+#include "trace.hpp"
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Render server, one request per line, answered with a line starting with ok or error
+//
+//   render scene=<scene file or built-in index> [width=W] [height=H] [spp=N] [depth=D]
+//          [eye=x,y,z] [at=x,y,z] [up=x,y,z] [fov=F] [output=file]
+//   evict scene=<scene>        drop a cached scene
+//   quit                       end the session, shutdown also stops a socket server
+//
+// Scenes stay loaded with their BVH between jobs, keyed by the scene argument.
+// Camera values not given are the scene's own.
+
+#define SERVER_LINE_LENGTH 4096
+
+struct RenderJob
+{
+    std::string scene;
+    std::string output = "result.png";
+    int width = 0;
+    int height = 256;
+    int samples_per_pixel = 16;
+    int max_depth = 50;
+    bool has_eye = false, has_at = false, has_up = false, has_fov = false;
+    vec3 eye, at, up;
+    float fov;
+};
+
+class RenderServer
+{
+private:
+    std::map<std::string, shared_ptr<SceneSetup> > m_scenes;
+    int m_jobs;
+
+    static bool parse_vec3(const char * text, vec3 & value)
+    {
+        return sscanf(text, "%f,%f,%f", &value.x, &value.y, &value.z) == 3;
+    }
+
+    /**
+     * Fill job from key=value arguments, returns an error message or nullptr
+     */
+    static const char * parse_job(char * arguments, RenderJob & job)
+    {
+        for (char * token = strtok(arguments, " \t\r\n"); token; token = strtok(nullptr, " \t\r\n"))
+        {
+            char * value = strchr(token, '=');
+            if (!value) return "Arguments must be key=value";
+            *value++ = '\0';
+            bool ok = true;
+            if (strcmp(token, "scene") == 0) job.scene = value;
+            else if (strcmp(token, "output") == 0) job.output = value;
+            else if (strcmp(token, "width") == 0) job.width = atoi(value);
+            else if (strcmp(token, "height") == 0) job.height = atoi(value);
+            else if (strcmp(token, "spp") == 0) job.samples_per_pixel = atoi(value);
+            else if (strcmp(token, "depth") == 0) job.max_depth = atoi(value);
+            else if (strcmp(token, "eye") == 0) ok = job.has_eye = parse_vec3(value, job.eye);
+            else if (strcmp(token, "at") == 0) ok = job.has_at = parse_vec3(value, job.at);
+            else if (strcmp(token, "up") == 0) ok = job.has_up = parse_vec3(value, job.up);
+            else if (strcmp(token, "fov") == 0) ok = job.has_fov = sscanf(value, "%f", &job.fov) == 1;
+            else return "Unknown argument";
+            if (!ok) return "Malformed value";
+        }
+        if (job.scene.empty()) return "Missing scene";
+        if (job.height <= 1 || job.width < 0 || job.samples_per_pixel <= 0) return "Bad resolution or spp";
+        if (!Utility::Image::can_save(job.output.c_str())) return "Output must be .png, .jpg, .bmp, .tga or .hdr";
+        return nullptr;
+    }
+
+    /**
+     * Cached scene of a file path or built-in scene number, loaded on first use
+     */
+    shared_ptr<SceneSetup> scene(const std::string & key)
+    {
+        auto it = m_scenes.find(key);
+        if (it != m_scenes.end()) return it->second;
+
+        auto setup = make_shared<SceneSetup>();
+        setup->aspect_ratio = 0.0f;
+        // Rendering reseeds this thread's generator, scenes get the same one every time
+        seed_random(SCENE_SEED);
+        char * end;
+        long index = strtol(key.c_str(), &end, 10);
+        bool loaded = *end == '\0' ? setup_scene((int)index, *setup) : Scene::load_scene_file(key.c_str(), *setup);
+        if (!loaded) return nullptr;
+        m_scenes[key] = setup;
+        return setup;
+    }
+
+    /**
+     * Render a frame the way the tiled renderer does without checkpoints
+     */
+    void render(const RenderJob & job, const SceneSetup & setup, Utility::Image & image)
+    {
+        float aspect_ratio = (float)image.width() / image.height();
+        Scene::Camera camera(job.has_eye ? job.eye : setup.eye, job.has_at ? job.at : setup.at,
+            job.has_up ? job.up : setup.up, job.has_fov ? job.fov : setup.fov, aspect_ratio, 0.1f, 10.0f, 1.0f);
+        camera.set_image_height(image.height());
+
+        int width = image.width();
+        int height = image.height();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int j = 0; j < height; j++)
+        for (int i = 0; i < width; i++)
+        {
+            vec4 pixel_color(0.0f);
+            seed_pixel(0, j * width + i, 0);
+            trace_pixel(camera, setup.world, i, j, width, height, job.samples_per_pixel, job.max_depth, true,
+                [&](const vec4 & color) { pixel_color += color; });
+            pixel_color *= 1.0f / job.samples_per_pixel;
+            image(i, j, 0) = pixel_color.r;
+            image(i, j, 1) = pixel_color.g;
+            image(i, j, 2) = pixel_color.b;
+        }
+    }
+
+    /**
+     * Handle one request line, false once the session should end
+     */
+    bool handle(char * line, FILE * out, bool & shutdown)
+    {
+        char * command = strtok(line, " \t\r\n");
+        char * arguments = strtok(nullptr, "");
+        char empty[1] = "";
+        if (!arguments) arguments = empty;
+        if (!command) return true;
+
+        if (strcmp(command, "quit") == 0 || strcmp(command, "shutdown") == 0)
+        {
+            shutdown = strcmp(command, "shutdown") == 0;
+            fprintf(out, "ok bye\n");
+            return false;
+        }
+        else if (strcmp(command, "evict") == 0)
+        {
+            RenderJob job;
+            const char * message = parse_job(arguments, job);
+            if (message) fprintf(out, "error %s\n", message);
+            else if (m_scenes.erase(job.scene)) fprintf(out, "ok evicted %s\n", job.scene.c_str());
+            else fprintf(out, "error Scene not cached\n");
+        }
+        else if (strcmp(command, "render") == 0)
+        {
+            TRACE_SCOPE_ARG("job", m_jobs);
+            double start = wall_seconds();
+            RenderJob job;
+            const char * message = parse_job(arguments, job);
+            bool cached = !message && m_scenes.count(job.scene);
+            shared_ptr<SceneSetup> setup = message ? nullptr : scene(job.scene);
+            if (message)
+            {
+                fprintf(out, "error %s\n", message);
+            }
+            else if (!setup)
+            {
+                fprintf(out, "error Failed to load scene %s\n", job.scene.c_str());
+            }
+            else
+            {
+                double setup_seconds = wall_seconds() - start;
+                // Scenes that need a certain aspect ratio get it unless the width is given
+                float aspect_ratio = setup->aspect_ratio > 0.0f ? setup->aspect_ratio : 3.0f / 2.0f;
+                int width = job.width > 0 ? job.width : static_cast<int>(job.height * aspect_ratio);
+                Utility::Image image(width, job.height, 3);
+                render(job, *setup, image);
+                image.save(job.output.c_str());
+                m_jobs++;
+                fprintf(out, "ok %s %dx%d %d spp, scene %s in %.3fs, total %.3fs\n", job.output.c_str(), width, job.height,
+                    job.samples_per_pixel, cached ? "cached" : "loaded", setup_seconds, wall_seconds() - start);
+            }
+        }
+        else
+        {
+            fprintf(out, "error Unknown command %s\n", command);
+        }
+        fflush(out);
+        return true;
+    }
+
+public:
+    RenderServer(): m_jobs(0) {}
+
+    /**
+     * Answer requests from in on out until quit or the end of input,
+     * returns true if asked to shut down
+     */
+    bool serve(FILE * in, FILE * out)
+    {
+        char line[SERVER_LINE_LENGTH];
+        bool shutdown = false;
+        while (fgets(line, sizeof(line), in))
+        {
+            if (!handle(line, out, shutdown)) break;
+        }
+        fflush(out);
+        return shutdown;
+    }
+
+    /**
+     * Listen on a UNIX socket, serving one connection at a time until a shutdown request
+     */
+    bool serve_socket(const char * path)
+    {
+#ifdef __linux__
+        int server = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+        unlink(path);
+        if (server < 0 || bind(server, (sockaddr *)&address, sizeof(address)) != 0 || listen(server, 4) != 0)
+        {
+            printf("[ERROR] Failed to listen on [%s]\n", path);
+            if (server >= 0) close(server);
+            return false;
+        }
+        printf("[INFO] Render server listening on [%s]\n", path);
+        fflush(stdout);
+
+        bool shutdown = false;
+        while (!shutdown)
+        {
+            int client = accept(server, nullptr, nullptr);
+            if (client < 0) continue;
+            FILE * in = fdopen(client, "r");
+            FILE * out = fdopen(dup(client), "w");
+            shutdown = serve(in, out);
+            fclose(out);
+            fclose(in);
+        }
+        close(server);
+        unlink(path);
+        return true;
+#else
+        printf("[ERROR] UNIX sockets are not supported on this platform, serve stdin instead\n");
+        return false;
+#endif
+    }
+};
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef __STATS_HPP__
+#define __STATS_HPP__
+
+#include <stdio.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <string>
+#include "image.hpp"
+
+// Build with -DRENDER_STATS (make STATS=1) to collect per-thread counters,
+// otherwise the STATS_ macros compile to nothing
+
+#ifdef RENDER_STATS
+#define STATS_COUNT(counter) (Utility::thread_stats().counter++)
+#define STATS_TIMER(counter) Utility::ScopedTimer stats_timer_##counter(Utility::thread_stats().counter)
+#else
+#define STATS_COUNT(counter) ((void)0)
+#define STATS_TIMER(counter) ((void)0)
+#endif
+
+namespace Utility
+{
+
+struct RenderStats
+{
+    unsigned long long rays = 0;
+    unsigned long long bvh_nodes = 0;
+    unsigned long long primitive_tests = 0;
+    // Nanoseconds, shading includes the texture lookups it makes
+    unsigned long long intersect_ns = 0;
+    unsigned long long shading_ns = 0;
+    unsigned long long texture_ns = 0;
+
+    void add(const RenderStats & other)
+    {
+        rays += other.rays;
+        bvh_nodes += other.bvh_nodes;
+        primitive_tests += other.primitive_tests;
+        intersect_ns += other.intersect_ns;
+        shading_ns += other.shading_ns;
+        texture_ns += other.texture_ns;
+    }
+};
+
+/**
+ * Stats of every thread that recorded any, kept alive after the thread exits
+ */
+class StatsRegistry
+{
+private:
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<RenderStats> > m_threads;
+
+public:
+    RenderStats * add_thread()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_threads.push_back(std::unique_ptr<RenderStats>(new RenderStats()));
+        return m_threads.back().get();
+    }
+
+    /**
+     * Write the counters of each thread and their total,
+     * only call once the render threads are done
+     */
+    bool write_json(const char * filename, double wall_seconds)
+    {
+        FILE * file = fopen(filename, "w");
+        if (!file)
+        {
+            printf("[ERROR] Failed to open [%s]\n", filename);
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        RenderStats total;
+        fprintf(file, "{\n  \"wall_seconds\": %.6f,\n  \"threads\": [\n", wall_seconds);
+        for (size_t i = 0; i < m_threads.size(); i++)
+        {
+            fprintf(file, "    ");
+            write_entry(file, *m_threads[i]);
+            fprintf(file, i + 1 < m_threads.size() ? ",\n" : "\n");
+            total.add(*m_threads[i]);
+        }
+        fprintf(file, "  ],\n  \"total\": ");
+        write_entry(file, total);
+        fprintf(file, "\n}\n");
+        fclose(file);
+        return true;
+    }
+
+private:
+    static void write_entry(FILE * file, const RenderStats & stats)
+    {
+        fprintf(file, "{\"rays\": %llu, \"bvh_nodes\": %llu, \"primitive_tests\": %llu, "
+                      "\"intersect_ns\": %llu, \"shading_ns\": %llu, \"texture_ns\": %llu}",
+            stats.rays, stats.bvh_nodes, stats.primitive_tests,
+            stats.intersect_ns, stats.shading_ns, stats.texture_ns);
+    }
+};
+
+inline StatsRegistry & stats_registry()
+{
+    static StatsRegistry registry;
+    return registry;
+}
+
+inline RenderStats & thread_stats()
+{
+    static thread_local RenderStats * stats = stats_registry().add_thread();
+    return *stats;
+}
+
+/**
+ * Adds the wall time of its scope to a counter in nanoseconds
+ */
+class ScopedTimer
+{
+private:
+    unsigned long long & m_counter;
+    std::chrono::steady_clock::time_point m_start;
+
+public:
+    ScopedTimer(unsigned long long & counter):
+        m_counter(counter),
+        m_start(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer()
+    {
+        m_counter += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - m_start).count();
+    }
+};
+
+/**
+ * Counters of the calling thread and the time when a pixel started
+ */
+class CostProbe
+{
+private:
+    RenderStats m_stats;
+    double m_start;
+
+public:
+    CostProbe(bool active): m_start(0.0)
+    {
+        if (!active) return;
+#ifdef RENDER_STATS
+        m_stats = thread_stats();
+#endif
+        m_start = wall_seconds();
+    }
+
+    const RenderStats & stats() const { return m_stats; }
+    double start() const { return m_start; }
+};
+
+/**
+ * Per-pixel cost of a render for diagnostic heatmaps: BVH node visits,
+ * primitive tests, path length and time, each averaged per sample.
+ * All but the time need the counters of a RENDER_STATS build.
+ */
+class CostMaps
+{
+private:
+    enum { COST_SAMPLES, COST_NODES, COST_PRIMITIVES, COST_RAYS, COST_NS, COST_NUM };
+
+    int m_width;
+    int m_height;
+    std::vector<double> m_costs;
+
+public:
+    CostMaps(int width, int height):
+        m_width(width),
+        m_height(height),
+        m_costs(width * height * COST_NUM, 0.0) {}
+
+    /**
+     * Add what the calling thread spent since the probe, on the given samples of pixel (x, y)
+     */
+    void add(int x, int y, const CostProbe & probe, int samples)
+    {
+        double * cost = &m_costs[(y * m_width + x) * COST_NUM];
+        cost[COST_SAMPLES] += samples;
+        cost[COST_NS] += (wall_seconds() - probe.start()) * 1e9;
+#ifdef RENDER_STATS
+        const RenderStats & now = thread_stats();
+        cost[COST_NODES] += now.bvh_nodes - probe.stats().bvh_nodes;
+        cost[COST_PRIMITIVES] += now.primitive_tests - probe.stats().primitive_tests;
+        cost[COST_RAYS] += now.rays - probe.stats().rays;
+#endif
+    }
+
+    /**
+     * Save false colour maps as <prefix>_nodes.png etc.
+     */
+    void save(const char * prefix) const
+    {
+#ifdef RENDER_STATS
+        save_map(prefix, "nodes", COST_NODES);
+        save_map(prefix, "primitives", COST_PRIMITIVES);
+        save_map(prefix, "path_length", COST_RAYS);
+#else
+        printf("[WARNING] Node, primitive and path length heatmaps need a build with STATS=1\n");
+#endif
+        save_map(prefix, "time_ns", COST_NS);
+    }
+
+private:
+    void save_map(const char * prefix, const char * name, int metric) const
+    {
+        Image values(m_width, m_height, 1);
+        for (int y = 0; y < m_height; y++)
+        for (int x = 0; x < m_width; x++)
+        {
+            const double * cost = &m_costs[(y * m_width + x) * COST_NUM];
+            values(x, y, 0) = cost[COST_SAMPLES] > 0.0 ? (float)(cost[metric] / cost[COST_SAMPLES]) : 0.0f;
+        }
+
+        float max_value;
+        Image heatmap = false_color(values, max_value);
+        std::string filename = std::string(prefix) + "_" + name + ".png";
+        heatmap.save(filename.c_str());
+        printf("[INFO] Heatmap of %s per sample saved to [%s], red at %g\n", name, filename.c_str(), max_value);
+    }
+};
+
+} // namespace Utility
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef __TRACE_HPP__
+#define __TRACE_HPP__
+
+#include <stdio.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// Record the enclosing scope as a timeline event, names must be string literals
+#define TRACE_SCOPE(name) Utility::TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, arg) Utility::TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, arg)
+
+namespace Utility
+{
+
+struct TraceEvent
+{
+    const char * name;
+    int arg;
+    long long start_ns;
+    long long duration_ns;
+};
+
+/**
+ * Timeline of coarse events (tiles, passes, loading, saving). Every thread
+ * appends to its own buffer, so recording takes no lock; only the first
+ * event of a thread registers its buffer. Disabled unless enable() is called.
+ */
+class Tracer
+{
+private:
+    struct Buffer
+    {
+        int thread_id;
+        std::vector<TraceEvent> events;
+    };
+
+    bool m_enabled;
+    std::chrono::steady_clock::time_point m_origin;
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<Buffer> > m_buffers;
+
+    Buffer * add_thread()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_buffers.push_back(std::unique_ptr<Buffer>(new Buffer()));
+        m_buffers.back()->thread_id = (int)m_buffers.size() - 1;
+        return m_buffers.back().get();
+    }
+
+public:
+    Tracer(): m_enabled(false), m_origin(std::chrono::steady_clock::now()) {}
+
+    void enable() { m_enabled = true; }
+    bool enabled() const { return m_enabled; }
+
+    long long now_ns() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - m_origin).count();
+    }
+
+    void record(const char * name, int arg, long long start_ns, long long end_ns)
+    {
+        static thread_local Buffer * buffer = add_thread();
+        TraceEvent event = { name, arg, start_ns, end_ns - start_ns };
+        buffer->events.push_back(event);
+    }
+
+    /**
+     * Write all events in Chrome trace format (chrome://tracing, Perfetto),
+     * only call once the other threads stopped recording
+     */
+    bool write_json(const char * filename)
+    {
+        FILE * file = fopen(filename, "w");
+        if (!file)
+        {
+            printf("[ERROR] Failed to open [%s]\n", filename);
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        fprintf(file, "{\"traceEvents\": [\n");
+        bool first = true;
+        for (size_t i = 0; i < m_buffers.size(); i++)
+        {
+            const Buffer & buffer = *m_buffers[i];
+            fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+                first ? "" : ",\n", buffer.thread_id, buffer.thread_id);
+            first = false;
+            for (size_t j = 0; j < buffer.events.size(); j++)
+            {
+                const TraceEvent & event = buffer.events[j];
+                fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"value\": %d}}",
+                    event.name, buffer.thread_id, event.start_ns * 1e-3, event.duration_ns * 1e-3, event.arg);
+            }
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+        return true;
+    }
+};
+
+inline Tracer & tracer()
+{
+    static Tracer instance;
+    return instance;
+}
+
+class TraceScope
+{
+private:
+    const char * m_name;
+    int m_arg;
+    long long m_start;
+
+public:
+    TraceScope(const char * name, int arg = 0):
+        m_name(name),
+        m_arg(arg),
+        m_start(tracer().enabled() ? tracer().now_ns() : -1) {}
+
+    ~TraceScope()
+    {
+        if (m_start >= 0) tracer().record(m_name, m_arg, m_start, tracer().now_ns());
+    }
+};
+
+} // namespace Utility
+
+#endif